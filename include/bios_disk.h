@@ -20,6 +20,7 @@
 #define DOSBOX_BIOS_DISK_H
 
 #include <stdio.h>
+#include <vector>
 #ifndef DOSBOX_MEM_H
 #include "mem.h"
 #endif
@@ -43,19 +44,33 @@ struct diskGeo {
 };
 extern diskGeo DiskGeometryList[];
 
+/* Image data is cached in blocks, written back on eviction and Flush */
+#define IMGDISK_CACHE_BLOCKS 64
+#define IMGDISK_BLOCK_SIZE (32*1024)
+
+class compressedImage;
+
 class imageDisk  {
 public:
 	Bit8u Read_Sector(Bit32u head,Bit32u cylinder,Bit32u sector,void * data);
 	Bit8u Write_Sector(Bit32u head,Bit32u cylinder,Bit32u sector,void * data);
 	Bit8u Read_AbsoluteSector(Bit32u sectnum, void * data);
 	Bit8u Write_AbsoluteSector(Bit32u sectnum, void * data);
+	Bit8u Read_AbsoluteSectors(Bit32u sectnum, Bit32u count, void * data);
+	Bit8u Write_AbsoluteSectors(Bit32u sectnum, Bit32u count, void * data);
+	Bit8u Flush(void);
+	static void FlushAll(void);
+	/* Failed write back since the last call, 0x05 or 0x00 */
+	Bit8u TakeWriteError(void);
+	/* Send all writes to a delta file, the image itself stays untouched */
+	bool SetOverlay(const char * overlayName);
 
 	void Set_Geometry(Bit32u setHeads, Bit32u setCyl, Bit32u setSect, Bit32u setSectSize);
 	void Get_Geometry(Bit32u * getHeads, Bit32u *getCyl, Bit32u *getSect, Bit32u *getSectSize);
 	Bit8u GetBiosType(void);
 	Bit32u getSectSize(void);
-	imageDisk(FILE *imgFile, Bit8u *imgName, Bit32u imgSizeK, bool isHardDisk);
-	~imageDisk() { if(diskimg != NULL) { fclose(diskimg); }	};
+	imageDisk(FILE *imgFile, Bit8u *imgName, Bit32u imgSizeK, bool isHardDisk, bool isReadOnly);
+	~imageDisk();
 
 	bool hardDrive;
 	bool active;
@@ -65,9 +80,42 @@ public:
 
 	Bit32u sector_size;
 	Bit32u heads,cylinders,sectors;
+private:
+	struct CacheBlock {
+		Bit32u block;
+		Bit32u lastUse;
+		bool dirty;
+		Bit8u * data;
+	};
+	Bit8u ReadBytes(Bit32u pos, Bit32u len, void * data);
+	Bit8u WriteBytes(Bit32u pos, Bit32u len, void * data);
+	CacheBlock * GetBlock(Bit32u block, bool load);
+	Bit32u LoadBlock(Bit32u block, Bit8u * data);
+	void WriteBlock(CacheBlock * cb);
+	void WriteOverlayHeader(void);
+
+	CacheBlock cache[IMGDISK_CACHE_BLOCKS];
+	bool dirty;			/* some block is dirty */
+	Bit8u writeError;	/* sticky until the guest gets to see it */
+	Bitu lastHit;
+	Bit32u useCount;
+	Bit32u imgSize;
+	bool readOnly;
+	/* Read-only images are mapped whole instead of cached */
+	Bit8u * mapped;
+	Bit32u mappedSize;
+	/* Compressed images are read through their block index */
+	compressedImage * packed;
+	/* Delta file: header, then records of block number and block data */
+	FILE * overlay;
+	std::vector<Bit32u> overlayIndex;
+	Bit32u overlayRecords;
+	imageDisk * next;
+	static imageDisk * first;
 };
 
 void updateDPT(void);
+void BIOS_FlushDisks(void);
 
 #define MAX_HDD_IMAGES 2
 
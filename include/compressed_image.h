@@ -0,0 +1,69 @@
+/*
+ *  Copyright (C) 2002-2010  The DOSBox Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DOSBOX_COMPRESSED_IMAGE_H
+#define DOSBOX_COMPRESSED_IMAGE_H
+
+#include <stdio.h>
+#ifndef DOSBOX_DOSBOX_H
+#include "dosbox.h"
+#endif
+
+/* Container layout: a 32 byte header, an index of blockCount+1 64-bit
+   file offsets and the zlib compressed blocks. A block whose stored
+   length equals its data length is kept uncompressed. */
+#define CIMAGE_HEADER_SIZE 32
+#define CIMAGE_BLOCK_SIZE (64*1024)
+/* Largest block size accepted from a header */
+#define CIMAGE_MAX_BLOCK_SIZE (16*1024*1024)
+#define CIMAGE_CACHE_BLOCKS 4
+
+class compressedImage {
+public:
+	/* Returns 0 when the file is not a compressed image */
+	static compressedImage * Open(FILE * imgFile);
+	/* Data size of a plain or compressed image file */
+	static Bit64u ImageSize(FILE * imgFile);
+	/* Pack a raw disk or CD image into a new container */
+	static bool Convert(const char * srcName, const char * dstName);
+	~compressedImage();
+
+	/* Returns the number of bytes read, short at the end of the image */
+	Bitu Read(Bit64u pos, Bitu len, void * data);
+	Bit64u GetSize(void) { return size; }
+private:
+	struct CacheBlock {
+		Bit32u block;
+		Bit32u lastUse;
+		Bit8u * data;
+	};
+	compressedImage(FILE * imgFile);
+	bool ReadHeader(void);
+	CacheBlock * GetBlock(Bit32u block);
+
+	FILE * file;
+	Bit64u size;
+	Bit32u blockSize;
+	Bit32u blockCount;
+	Bit64u * index;
+	Bit8u * packed;
+	CacheBlock cache[CIMAGE_CACHE_BLOCKS];
+	Bit32u useCount;
+};
+
+#endif
@@ -74,6 +74,7 @@ public:
 	static void CreatePlatformConfigDir(std::string& in);
 	static void ResolveHomedir(std::string & temp_line);
 	static void CreateDir(std::string const& temp);
+	static Bit64u GetMicroTicks(void);	// host clock for measurements, not tied to the emulation
 };
 
 
@@ -111,6 +111,7 @@ enum { HAND_NONE=0,HAND_FILE,HAND_DEVICE};
 void DOS_SetupFiles (void);
 bool DOS_ReadFile(Bit16u handle,Bit8u * data,Bit16u * amount);
 bool DOS_WriteFile(Bit16u handle,Bit8u * data,Bit16u * amount);
+bool DOS_IsFileHandle(Bit16u handle);
 bool DOS_SeekFile(Bit16u handle,Bit32u * pos,Bit32u type);
 bool DOS_CloseFile(Bit16u handle);
 bool DOS_FlushFile(Bit16u handle);
@@ -22,6 +22,9 @@
 #define DOSBOX_DOS_SYSTEM_H
 
 #include <vector>
+#include <map>
+#include <string>
+#include <stdio.h>
 #ifndef DOSBOX_DOSBOX_H
 #include "dosbox.h"
 #endif
@@ -124,6 +127,9 @@ private:
 #define MAX_OPENDIRS 2048
 //Can be high as it's only storage (16 bit variable)
 
+/* Prefix of the files that hide deleted entries in an overlay directory */
+#define OVERLAY_WHITEOUT ".wh."
+
 class DOS_Drive_Cache {
 public:
 	DOS_Drive_Cache					(void);
@@ -133,6 +139,8 @@ public:
 	enum TDirSort { NOSORT, ALPHABETICAL, DIRALPHABETICAL, ALPHABETICALREV, DIRALPHABETICALREV };
 
 	void		SetBaseDir			(const char* path);
+	void		SetOverlayDir		(const char* path);
+	void		SetCacheFile		(const char* file);
 	void		SetDirSort			(TDirSort sort) { sortDirType = sort; };
 	bool		OpenDir				(const char* path, Bit16u& id);
 	bool		ReadDir				(Bit16u id, char* &result);
@@ -149,6 +157,7 @@ public:
 	void		DeleteEntry			(const char* path, bool ignoreLastDir = false);
 
 	void		EmptyCache			(void);
+	void		ResetCache			(void);
 	void		SetLabel			(const char* name,bool cdrom,bool allowupdate);
 	char*		GetLabel			(void) { return label; };
 
@@ -158,42 +167,66 @@ public:
 			orgname[0] = shortname[0] = 0;
 			nextEntry = shortNr = 0;
 			isDir = false;
+			stamp = 0;
+			watch = -1;
+			nextShort = nextLong = 0;
 		}
 		~CFileInfo(void) {
 			for (Bit32u i=0; i<fileList.size(); i++) delete fileList[i];
 			fileList.clear();
-			longNameList.clear();
 		};
 		char		orgname		[CROSS_LEN];
 		char		shortname	[DOS_NAMELENGTH_ASCII];
 		bool		isDir;
 		Bitu		nextEntry;
 		Bitu		shortNr;
-		// contents
+		// host directory state when cached in, 0 if unknown
+		Bit64u		stamp;
+		int			watch;
+		// hash chains of the parent directory
+		CFileInfo*	nextShort;
+		CFileInfo*	nextLong;
+		// contents, fileList is sorted by short name
 		std::vector<CFileInfo*>	fileList;
-		std::vector<CFileInfo*>	longNameList;
+		std::vector<CFileInfo*>	shortHash;
+		std::vector<CFileInfo*>	longHash;
+		// last ~N used for each short name prefix
+		std::map<std::string,Bitu>	shortNrs;
 	};
 
 private:
 
 	bool		RemoveTrailingDot	(char* shortname);
-	Bits		GetLongName		(CFileInfo* info, char* shortname);
+	CFileInfo*	GetLongName		(CFileInfo* info, char* shortname);
+	CFileInfo*	FindShortName		(CFileInfo* dir, const char* shortname);
+	CFileInfo*	FindLongName		(CFileInfo* dir, const char* longname);
+	void		AddToIndex		(CFileInfo* dir, CFileInfo* info);
 	void		CreateShortName		(CFileInfo* dir, CFileInfo* info);
-	Bitu		CreateShortNameID	(CFileInfo* dir, const char* name);
-	int		CompareShortname	(const char* compareName, const char* shortName);
 	bool		SetResult		(CFileInfo* dir, char * &result, Bitu entryNr);
 	bool		IsCachedIn		(CFileInfo* dir);
 	CFileInfo*	FindDirInfo		(const char* path, char* expandedPath);
 	bool		RemoveSpaces		(char* str);
+	bool		ShortNameBase		(char* &tmpName, Bits& len);
 	bool		OpenDir			(CFileInfo* dir, const char* path, Bit16u& id);
-	void		CreateEntry		(CFileInfo* dir, const char* name, bool query_directory);
+	bool		OverlayName		(const char* path, char* overlayName);
+	CFileInfo*	CreateEntry		(CFileInfo* dir, const char* name, bool query_directory);
 	void		CopyEntry		(CFileInfo* dir, CFileInfo* from);
 	Bit16u		GetFreeID		(CFileInfo* dir);
 	void		Clear			(void);
+	Bit64u		GetDirStamp		(const char* path);
+	void		WatchDir		(CFileInfo* dir, const char* path);
+	void		UnwatchDir		(CFileInfo* dir);
+	void		ReadEvents		(void);
+	void		RefreshDir		(CFileInfo* dir, const char* path);
+	void		DropContents		(CFileInfo* dir);
+	bool		SaveDir			(FILE* file, CFileInfo* dir);
+	bool		LoadDir			(FILE* file, CFileInfo* dir);
+	void		SaveCacheFile		(void);
 
 	CFileInfo*	dirBase;
 	char		dirPath				[CROSS_LEN];
 	char		basePath			[CROSS_LEN];
+	char		overlayPath			[CROSS_LEN];
 	bool		dirFirstTime;
 	TDirSort	sortDirType;
 	CFileInfo*	save_dir;
@@ -209,6 +242,10 @@ private:
 
 	char		label				[CROSS_LEN];
 	bool		updatelabel;
+
+	char		cacheFile			[CROSS_LEN];
+	int			notifyFd;
+	std::map<int,CFileInfo*>	watches;
 };
 
 class DOS_Drive {
@@ -88,6 +88,7 @@ typedef struct {
 	Bit16u		sw;
 	Bitu		top;
 	FPU_Round	round;
+	bool		host_round;
 } FPU_rec;
 
 
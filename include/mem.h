@@ -154,6 +154,9 @@ void MEM_BlockWrite(PhysPt pt,void const * const data,Bitu size);
 void MEM_BlockRead(PhysPt pt,void * data,Bitu size);
 void MEM_BlockCopy(PhysPt dest,PhysPt src,Bitu size);
 void MEM_StrCopy(PhysPt pt,char * data,Bitu size);
+/* Host memory behind a block that is plain ram in one piece, 0 otherwise */
+HostPt MEM_GetBlockReadPt(PhysPt pt,Bitu size);
+HostPt MEM_GetBlockWritePt(PhysPt pt,Bitu size);
 
 void mem_memcpy(PhysPt dest,PhysPt src,Bitu size);
 Bitu mem_strlen(PhysPt pt);
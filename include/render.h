@@ -28,8 +28,9 @@
 #include "../src/gui/render_scalers.h"
 
 #define RENDER_SKIP_CACHE	16
+#define RENDER_PACING_BUCKETS	6
 //Enable this for scalers to support 0 input for empty lines
-//#define RENDER_NULL_INPUT
+#define RENDER_NULL_INPUT
 
 typedef struct {
 	struct { 
@@ -46,6 +47,9 @@ typedef struct {
 	Bit8u modified[256];
 	Bitu first;
 	Bitu last;
+	/* Range of entries flagged in modified during the last frame */
+	Bitu modFirst;
+	Bitu modLast;
 } RenderPal_t;
 
 typedef struct {
@@ -62,6 +66,13 @@ typedef struct {
 		Bitu max;
 		Bitu index;
 		Bit8u hadSkip[RENDER_SKIP_CACHE];
+		/* Frame pacing, host time per guest frame over about a second */
+		bool autoAdjust;
+		Bitu stable;
+		Bitu frames;
+		Bit32u lastTicks, windowTicks;
+		Bit64u drawMicros;		// host time generating and presenting lines
+		Bitu histogram[RENDER_PACING_BUCKETS];
 	} frameskip;
 	struct {
 		Bitu size;
@@ -85,6 +96,7 @@ typedef struct {
 	bool active;
 	bool aspect;
 	bool fullFrame;
+	bool frameAtOnce;
 } Render_t;
 
 extern Render_t render;
@@ -92,7 +104,7 @@ extern ScalerLineHandler_t RENDER_DrawLine;
 void RENDER_SetSize(Bitu width,Bitu height,Bitu bpp,float fps,double ratio,bool dblw,bool dblh);
 bool RENDER_StartUpdate(void);
 void RENDER_EndUpdate(bool abort);
-void RENDER_SetPal(Bit8u entry,Bit8u red,Bit8u green,Bit8u blue);
+bool RENDER_SetPal(Bit8u entry,Bit8u red,Bit8u green,Bit8u blue);
 
 
 #endif
@@ -29,6 +29,7 @@
 #define VGA_LFB_MAPPED
 //#define VGA_KEEP_CHANGES
 #define VGA_CHANGE_SHIFT	9
+#define VGA_DIRTY_SHIFT		6
 
 class PageHandler;
 
@@ -114,6 +115,7 @@ typedef struct {
 typedef enum {
 	PART,
 	LINE,
+	FRAME,
 	//EGALINE
 } Drawmode;
 
@@ -164,6 +166,7 @@ typedef struct {
 		Bit8u enabled;
 	} cursor;
 	Drawmode mode;
+	Bit32u glyph_gen;	/* bumped to drop the cached text glyph rows */
 	bool vret_triggered;
 } VGA_Draw;
 
@@ -371,6 +374,14 @@ typedef struct {
 	Bit32u	lastAddress;
 } VGA_Changes;
 
+typedef struct {
+	Bit8u*	map; /* allocated dynamically: [((VGA_MEMORY << 1) >> VGA_DIRTY_SHIFT) + 2] */
+	Bit8u	frame;		/* stamped into the map on writes, advanced every drawn frame */
+	bool	tracked;	/* current memory handler stamps the map */
+	bool	skip;		/* lines reading unchanged memory can be skipped */
+	bool	invalid;	/* something besides memory changed, draw all of next frame */
+} VGA_Dirty;
+
 typedef struct {
 	Bit32u page;
 	Bit32u addr;
@@ -404,6 +415,7 @@ typedef struct {
 #ifdef VGA_KEEP_CHANGES
 	VGA_Changes changes;
 #endif
+	VGA_Dirty dirty;
 	VGA_LFB lfb;
 } VGA_Type;
 
@@ -415,6 +427,7 @@ void Herc_Palette(void);
 void VGA_SetMode(VGAModes mode);
 void VGA_DetermineMode(void);
 void VGA_SetupHandlers(void);
+void VGA_ChainedDirectFrame(void);
 void VGA_StartResize(Bitu delay=50);
 void VGA_SetupDrawing(Bitu val);
 void VGA_CheckScanLength(void);
@@ -446,6 +459,7 @@ void VGA_SetCGA2Table(Bit8u val0,Bit8u val1);
 void VGA_SetCGA4Table(Bit8u val0,Bit8u val1,Bit8u val2,Bit8u val3);
 void VGA_ActivateHardwareCursor(void);
 void VGA_KillDrawing(void);
+void VGA_FrameCatchUp(void);
 
 extern VGA_Type vga;
 
@@ -31,6 +31,7 @@ namespace WastelandEXT
 	void UpdateAudio(Bit8u *stream, int len);
 	
 	bool PreUpdate(Bitu width, Bitu height, Bitu bpp, Bitu pitch, Bit8u * data, Bit8u * pal, Bitu outPitch);
+	void StartUpdate();
 	void Update( SDL_Surface* surface );
 	void PostUpdate();
 
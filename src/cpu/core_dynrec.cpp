@@ -60,6 +60,9 @@
 #define CACHE_ALIGN		(16)
 #define DYN_HASH_SHIFT	(4)
 #define DYN_PAGE_HASH	(4096>>DYN_HASH_SHIFT)
+#define DYN_SMC_LINE_SHIFT	(6)
+#define DYN_SMC_LINES		(4096>>DYN_SMC_LINE_SHIFT)
+#define DYN_SMC_LINE_LIMIT	(16)
 #define DYN_LINKS		(16)
 
 #if 0
@@ -209,7 +212,7 @@ Bits CPU_Core_Dynrec_Run(void) {
 		if (!block) {
 			// no block found, thus translate the instruction stream
 			// unless the instruction is known to be modified
-			if (!chandler->invalidation_map || (chandler->invalidation_map[ip_point&4095]<4)) {
+			if (!chandler->IsSelfModifying(ip_point&4095)) {
 				// translate up to 32 instructions
 				block=CreateCacheBlock(chandler,ip_point,32);
 			} else {
@@ -79,6 +79,13 @@ static Bit8u * cache_code_link_blocks=NULL;
 static CacheBlockDynRec * cache_blocks=NULL;
 static CacheBlockDynRec link_blocks[2];		// default linking (specially marked)
 
+// self-modifying code statistics, to see which programs thrash the cache
+static struct {
+	Bitu invalidations;		// writes that hit translated code
+	Bitu released_pages;	// code pages that were given back to the memory handler
+	Bitu demoted_lines;		// lines that are left to the normal core
+} smc_stats;
+
 
 // the CodePageHandlerDynRec class provides access to the contained
 // cache blocks and intercepts writes to the code for special treatment
@@ -101,10 +108,13 @@ public:
 
 		active_blocks=0;
 		active_count=16;
+		invalidations=0;
+		demoted_lines=0;
 
 		// initialize the maps with zero (no cache blocks as well as code present)
 		memset(&hash_map,0,sizeof(hash_map));
 		memset(&write_map,0,sizeof(write_map));
+		memset(&line_map,0,sizeof(line_map));
 		if (invalidation_map!=NULL) {
 			free(invalidation_map);
 			invalidation_map=NULL;
@@ -139,6 +149,28 @@ public:
 		return is_current_block;
 	}
 
+	// count an invalidating write per line of the page, lines that are modified
+	// too often (code interleaved with data that is written) are not translated
+	// anymore but run through the normal core
+	void CountInvalidation(Bitu addr) {
+		invalidations++;
+		smc_stats.invalidations++;
+		Bitu line=addr>>DYN_SMC_LINE_SHIFT;
+		if (line_map[line]>=DYN_SMC_LINE_LIMIT) return;
+		if (++line_map[line]<DYN_SMC_LINE_LIMIT) return;
+		demoted_lines|=(Bit64u)1 << line;
+		smc_stats.demoted_lines++;
+		LOG(LOG_CPU,LOG_NORMAL)("DYNREC:Self-modifying code at %X, leaving line to the normal core (%d lines, %d invalidations total)",
+			(Bit32u)((phys_page<<12)+(line<<DYN_SMC_LINE_SHIFT)),(int)smc_stats.demoted_lines,(int)smc_stats.invalidations);
+	}
+
+	// check if the code at this position is known to be modified a lot
+	bool IsSelfModifying(Bitu index) {
+		if (!invalidation_map) return false;
+		if (invalidation_map[index]>=4) return true;
+		return (demoted_lines & ((Bit64u)1 << (index>>DYN_SMC_LINE_SHIFT)))!=0;
+	}
+
 	// the following functions will clean all cache blocks that are invalid now due to the write
 	void writeb(PhysPt addr,Bitu val){
 		addr&=4095;
@@ -155,6 +187,7 @@ public:
 			memset(invalidation_map,0,4096);
 		}
 		invalidation_map[addr]++;
+		CountInvalidation(addr);
 		InvalidateRange(addr,addr);
 	}
 	void writew(PhysPt addr,Bitu val){
@@ -177,6 +210,7 @@ public:
 #else
 		(*(Bit16u*)&invalidation_map[addr])+=0x101;
 #endif
+		CountInvalidation(addr);
 		InvalidateRange(addr,addr+1);
 	}
 	void writed(PhysPt addr,Bitu val){
@@ -199,6 +233,7 @@ public:
 #else
 		(*(Bit32u*)&invalidation_map[addr])+=0x1010101;
 #endif
+		CountInvalidation(addr);
 		InvalidateRange(addr,addr+3);
 	}
 	bool writeb_checked(PhysPt addr,Bitu val) {
@@ -217,6 +252,7 @@ public:
 				memset(invalidation_map,0,4096);
 			}
 			invalidation_map[addr]++;
+			CountInvalidation(addr);
 			if (InvalidateRange(addr,addr)) {
 				cpu.exception.which=SMC_CURRENT_BLOCK;
 				return true;
@@ -246,6 +282,7 @@ public:
 #else
 			(*(Bit16u*)&invalidation_map[addr])+=0x101;
 #endif
+			CountInvalidation(addr);
 			if (InvalidateRange(addr,addr+1)) {
 				cpu.exception.which=SMC_CURRENT_BLOCK;
 				return true;
@@ -275,6 +312,7 @@ public:
 #else
 			(*(Bit32u*)&invalidation_map[addr])+=0x1010101;
 #endif
+			CountInvalidation(addr);
 			if (InvalidateRange(addr,addr+3)) {
 				cpu.exception.which=SMC_CURRENT_BLOCK;
 				return true;
@@ -336,6 +374,9 @@ public:
 	}
 
 	void Release(void) {
+		smc_stats.released_pages++;
+		if (invalidations) LOG(LOG_CPU,LOG_NORMAL)("DYNREC:Releasing code page %X after %d invalidations (%d pages released)",
+			(Bit32u)(phys_page<<12),(int)invalidations,(int)smc_stats.released_pages);
 		MEM_SetPageHandler(phys_page,1,old_pagehandler);	// revert to old handler
 		PAGING_ClearTLB();
 
@@ -383,6 +424,10 @@ public:
 	// the write map, there are write_map[i] cache blocks that cover the byte at address i
 	Bit8u write_map[4096];
 	Bit8u * invalidation_map;
+	// number of invalidating writes per line, and the lines that reached DYN_SMC_LINE_LIMIT
+	Bit8u line_map[DYN_SMC_LINES];
+	Bit64u demoted_lines;
+	Bitu invalidations;
 	CodePageHandlerDynRec * next, * prev;	// page linking
 private:
 	PageHandler * old_pagehandler;
@@ -640,6 +685,8 @@ static void cache_init(bool enable) {
 }
 
 static void cache_close(void) {
+	if (smc_stats.invalidations) LOG_MSG("DYNREC:%d writes to translated code, %d code pages released, %d lines left to the normal core",
+		(int)smc_stats.invalidations,(int)smc_stats.released_pages,(int)smc_stats.demoted_lines);
 /*	for (;;) {
 		if (cache.used_pages) {
 			CodePageHandler * cpage=cache.used_pages;
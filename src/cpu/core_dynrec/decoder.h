@@ -74,13 +74,12 @@ restart_prefix:
 			// some entries in the invalidation map, see if the next
 			// instruction is known to be modified a lot
 			if (decode.page.index<4096) {
-				if (GCC_UNLIKELY(decode.page.invmap[decode.page.index]>=4)) goto illegalopcode;
+				if (GCC_UNLIKELY(decode.page.code->IsSelfModifying(decode.page.index))) goto illegalopcode;
 				opcode=decode_fetchb();
 			} else {
 				// switch to the next page
 				opcode=decode_fetchb();
-				if (GCC_UNLIKELY(decode.page.invmap && 
-					(decode.page.invmap[decode.page.index-1]>=4))) goto illegalopcode;
+				if (GCC_UNLIKELY(decode.page.code->IsSelfModifying(decode.page.index-1))) goto illegalopcode;
 			}
 		}
 		switch (opcode) {
@@ -1641,6 +1641,67 @@ static void DRC_CALL_CONV dynrec_std(void) {
 }
 
 
+// forward string moves and stores between plain memory pages are done on
+// the host memory directly, as many elements as fit into the current pages
+// (and before a 16bit index register wraps). Pages with handlers like mmio,
+// vga memory or code pages have no tlb pointer and return zero, skip then
+// holds the elements up to the next page boundary that the caller handles
+// through the memory handlers before probing again.
+static INLINE Bitu dynrec_bulk_elements(PhysPt addr,Bitu index,Bitu count,Bitu size,bool word_index) {
+	Bitu left=(4096-(addr&4095))/size;
+	if (word_index) {
+		Bitu index_left=(0x10000-index)/size;
+		if (index_left<left) left=index_left;
+	}
+	return (count<left) ? count : left;
+}
+
+static Bitu dynrec_bulk_movs(PhysPt si_base,Bitu si,PhysPt di_base,Bitu di,Bitu count,Bitu size,bool word_index,Bitu & skip) {
+	PhysPt src=si_base+si;
+	PhysPt dst=di_base+di;
+	count=dynrec_bulk_elements(src,si,count,size,word_index);
+	count=dynrec_bulk_elements(dst,di,count,size,word_index);
+	// an element crossing a page boundary is done on its own
+	skip=count ? count : 1;
+	if (!count) return 0;
+	HostPt tlb_read=get_tlb_read(src);
+	HostPt tlb_write=get_tlb_write(dst);
+	if (!tlb_read || !tlb_write) return 0;
+	HostPt hsrc=tlb_read+src;
+	HostPt hdst=tlb_write+dst;
+	// overlapping moves to a higher address repeat the source, do them elementwise
+	if ((hdst>hsrc) && (hdst<hsrc+count*size)) return 0;
+	memmove(hdst,hsrc,count*size);
+	skip=0;
+	return count;
+}
+
+static Bitu dynrec_bulk_stos(PhysPt di_base,Bitu di,Bitu count,Bitu size,bool word_index,Bit32u val,Bitu & skip) {
+	PhysPt dst=di_base+di;
+	count=dynrec_bulk_elements(dst,di,count,size,word_index);
+	skip=count ? count : 1;
+	if (!count) return 0;
+	HostPt tlb_write=get_tlb_write(dst);
+	if (!tlb_write) return 0;
+	skip=0;
+	HostPt hdst=tlb_write+dst;
+	switch (size) {
+	case 1:
+		memset(hdst,(Bit8u)val,count);
+		break;
+	case 2:
+		if ((val&0xff)==((val>>8)&0xff)) memset(hdst,(Bit8u)val,count*2);
+		else for (Bitu i=0;i<count;i++) host_writew(hdst+i*2,(Bit16u)val);
+		break;
+	case 4:
+		if (val==(val&0xff)*0x01010101) memset(hdst,(Bit8u)val,count*4);
+		else for (Bitu i=0;i<count;i++) host_writed(hdst+i*4,val);
+		break;
+	}
+	return count;
+}
+
+
 static Bit16u DRC_CALL_CONV dynrec_movsb_word(Bit16u count,Bit16s add_index,PhysPt si_base,PhysPt di_base) DRC_FC;
 static Bit16u DRC_CALL_CONV dynrec_movsb_word(Bit16u count,Bit16s add_index,PhysPt si_base,PhysPt di_base) {
 	Bit16u count_left;
@@ -1651,10 +1712,22 @@ static Bit16u DRC_CALL_CONV dynrec_movsb_word(Bit16u count,Bit16s add_index,Phys
 		count=(Bit16u)CPU_Cycles;
 		CPU_Cycles=0;
 	}
-	for (;count>0;count--) {
+	Bitu skip=0;
+	while (count>0) {
+		if (add_index>0 && !skip) {
+			Bitu done=dynrec_bulk_movs(si_base,reg_si,di_base,reg_di,count,1,true,skip);
+			if (done) {
+				count-=(Bit16u)done;
+				reg_si+=(Bit16u)(done);
+				reg_di+=(Bit16u)(done);
+				continue;
+			}
+		}
 		mem_writeb(di_base+reg_di,mem_readb(si_base+reg_si));
 		reg_si+=add_index;
 		reg_di+=add_index;
+		count--;
+		if (skip) skip--;
 	}
 	return count_left;
 }
@@ -1669,10 +1742,22 @@ static Bit32u DRC_CALL_CONV dynrec_movsb_dword(Bit32u count,Bit32s add_index,Phy
 		count=CPU_Cycles;
 		CPU_Cycles=0;
 	}
-	for (;count>0;count--) {
+	Bitu skip=0;
+	while (count>0) {
+		if (add_index>0 && !skip) {
+			Bitu done=dynrec_bulk_movs(si_base,reg_esi,di_base,reg_edi,count,1,false,skip);
+			if (done) {
+				count-=(Bit32u)done;
+				reg_esi+=done;
+				reg_edi+=done;
+				continue;
+			}
+		}
 		mem_writeb(di_base+reg_edi,mem_readb(si_base+reg_esi));
 		reg_esi+=add_index;
 		reg_edi+=add_index;
+		count--;
+		if (skip) skip--;
 	}
 	return count_left;
 }
@@ -1688,10 +1773,22 @@ static Bit16u DRC_CALL_CONV dynrec_movsw_word(Bit16u count,Bit16s add_index,Phys
 		CPU_Cycles=0;
 	}
 	add_index<<=1;
-	for (;count>0;count--) {
+	Bitu skip=0;
+	while (count>0) {
+		if (add_index>0 && !skip) {
+			Bitu done=dynrec_bulk_movs(si_base,reg_si,di_base,reg_di,count,2,true,skip);
+			if (done) {
+				count-=(Bit16u)done;
+				reg_si+=(Bit16u)(done*2);
+				reg_di+=(Bit16u)(done*2);
+				continue;
+			}
+		}
 		mem_writew(di_base+reg_di,mem_readw(si_base+reg_si));
 		reg_si+=add_index;
 		reg_di+=add_index;
+		count--;
+		if (skip) skip--;
 	}
 	return count_left;
 }
@@ -1707,10 +1804,22 @@ static Bit32u DRC_CALL_CONV dynrec_movsw_dword(Bit32u count,Bit32s add_index,Phy
 		CPU_Cycles=0;
 	}
 	add_index<<=1;
-	for (;count>0;count--) {
+	Bitu skip=0;
+	while (count>0) {
+		if (add_index>0 && !skip) {
+			Bitu done=dynrec_bulk_movs(si_base,reg_esi,di_base,reg_edi,count,2,false,skip);
+			if (done) {
+				count-=(Bit32u)done;
+				reg_esi+=done*2;
+				reg_edi+=done*2;
+				continue;
+			}
+		}
 		mem_writew(di_base+reg_edi,mem_readw(si_base+reg_esi));
 		reg_esi+=add_index;
 		reg_edi+=add_index;
+		count--;
+		if (skip) skip--;
 	}
 	return count_left;
 }
@@ -1726,10 +1835,22 @@ static Bit16u DRC_CALL_CONV dynrec_movsd_word(Bit16u count,Bit16s add_index,Phys
 		CPU_Cycles=0;
 	}
 	add_index<<=2;
-	for (;count>0;count--) {
+	Bitu skip=0;
+	while (count>0) {
+		if (add_index>0 && !skip) {
+			Bitu done=dynrec_bulk_movs(si_base,reg_si,di_base,reg_di,count,4,true,skip);
+			if (done) {
+				count-=(Bit16u)done;
+				reg_si+=(Bit16u)(done*4);
+				reg_di+=(Bit16u)(done*4);
+				continue;
+			}
+		}
 		mem_writed(di_base+reg_di,mem_readd(si_base+reg_si));
 		reg_si+=add_index;
 		reg_di+=add_index;
+		count--;
+		if (skip) skip--;
 	}
 	return count_left;
 }
@@ -1745,10 +1866,22 @@ static Bit32u DRC_CALL_CONV dynrec_movsd_dword(Bit32u count,Bit32s add_index,Phy
 		CPU_Cycles=0;
 	}
 	add_index<<=2;
-	for (;count>0;count--) {
+	Bitu skip=0;
+	while (count>0) {
+		if (add_index>0 && !skip) {
+			Bitu done=dynrec_bulk_movs(si_base,reg_esi,di_base,reg_edi,count,4,false,skip);
+			if (done) {
+				count-=(Bit32u)done;
+				reg_esi+=done*4;
+				reg_edi+=done*4;
+				continue;
+			}
+		}
 		mem_writed(di_base+reg_edi,mem_readd(si_base+reg_esi));
 		reg_esi+=add_index;
 		reg_edi+=add_index;
+		count--;
+		if (skip) skip--;
 	}
 	return count_left;
 }
@@ -1871,9 +2004,20 @@ static Bit16u DRC_CALL_CONV dynrec_stosb_word(Bit16u count,Bit16s add_index,Phys
 		count=(Bit16u)CPU_Cycles;
 		CPU_Cycles=0;
 	}
-	for (;count>0;count--) {
+	Bitu skip=0;
+	while (count>0) {
+		if (add_index>0 && !skip) {
+			Bitu done=dynrec_bulk_stos(di_base,reg_di,count,1,true,reg_al,skip);
+			if (done) {
+				count-=(Bit16u)done;
+				reg_di+=(Bit16u)(done);
+				continue;
+			}
+		}
 		mem_writeb(di_base+reg_di,reg_al);
 		reg_di+=add_index;
+		count--;
+		if (skip) skip--;
 	}
 	return count_left;
 }
@@ -1888,9 +2032,20 @@ static Bit32u DRC_CALL_CONV dynrec_stosb_dword(Bit32u count,Bit32s add_index,Phy
 		count=CPU_Cycles;
 		CPU_Cycles=0;
 	}
-	for (;count>0;count--) {
+	Bitu skip=0;
+	while (count>0) {
+		if (add_index>0 && !skip) {
+			Bitu done=dynrec_bulk_stos(di_base,reg_edi,count,1,false,reg_al,skip);
+			if (done) {
+				count-=(Bit32u)done;
+				reg_edi+=done;
+				continue;
+			}
+		}
 		mem_writeb(di_base+reg_edi,reg_al);
 		reg_edi+=add_index;
+		count--;
+		if (skip) skip--;
 	}
 	return count_left;
 }
@@ -1906,9 +2061,20 @@ static Bit16u DRC_CALL_CONV dynrec_stosw_word(Bit16u count,Bit16s add_index,Phys
 		CPU_Cycles=0;
 	}
 	add_index<<=1;
-	for (;count>0;count--) {
+	Bitu skip=0;
+	while (count>0) {
+		if (add_index>0 && !skip) {
+			Bitu done=dynrec_bulk_stos(di_base,reg_di,count,2,true,reg_ax,skip);
+			if (done) {
+				count-=(Bit16u)done;
+				reg_di+=(Bit16u)(done*2);
+				continue;
+			}
+		}
 		mem_writew(di_base+reg_di,reg_ax);
 		reg_di+=add_index;
+		count--;
+		if (skip) skip--;
 	}
 	return count_left;
 }
@@ -1924,9 +2090,20 @@ static Bit32u DRC_CALL_CONV dynrec_stosw_dword(Bit32u count,Bit32s add_index,Phy
 		CPU_Cycles=0;
 	}
 	add_index<<=1;
-	for (;count>0;count--) {
+	Bitu skip=0;
+	while (count>0) {
+		if (add_index>0 && !skip) {
+			Bitu done=dynrec_bulk_stos(di_base,reg_edi,count,2,false,reg_ax,skip);
+			if (done) {
+				count-=(Bit32u)done;
+				reg_edi+=done*2;
+				continue;
+			}
+		}
 		mem_writew(di_base+reg_edi,reg_ax);
 		reg_edi+=add_index;
+		count--;
+		if (skip) skip--;
 	}
 	return count_left;
 }
@@ -1942,9 +2119,20 @@ static Bit16u DRC_CALL_CONV dynrec_stosd_word(Bit16u count,Bit16s add_index,Phys
 		CPU_Cycles=0;
 	}
 	add_index<<=2;
-	for (;count>0;count--) {
+	Bitu skip=0;
+	while (count>0) {
+		if (add_index>0 && !skip) {
+			Bitu done=dynrec_bulk_stos(di_base,reg_di,count,4,true,reg_eax,skip);
+			if (done) {
+				count-=(Bit16u)done;
+				reg_di+=(Bit16u)(done*4);
+				continue;
+			}
+		}
 		mem_writed(di_base+reg_di,reg_eax);
 		reg_di+=add_index;
+		count--;
+		if (skip) skip--;
 	}
 	return count_left;
 }
@@ -1960,9 +2148,20 @@ static Bit32u DRC_CALL_CONV dynrec_stosd_dword(Bit32u count,Bit32s add_index,Phy
 		CPU_Cycles=0;
 	}
 	add_index<<=2;
-	for (;count>0;count--) {
+	Bitu skip=0;
+	while (count>0) {
+		if (add_index>0 && !skip) {
+			Bitu done=dynrec_bulk_stos(di_base,reg_edi,count,4,false,reg_eax,skip);
+			if (done) {
+				count-=(Bit32u)done;
+				reg_edi+=done*4;
+				continue;
+			}
+		}
 		mem_writed(di_base+reg_edi,reg_eax);
 		reg_edi+=add_index;
+		count--;
+		if (skip) skip--;
 	}
 	return count_left;
 }
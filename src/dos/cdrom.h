@@ -20,9 +20,18 @@
 #include "SDL_sound.h"
 #endif
 
+class compressedImage;
+
 #define RAW_SECTOR_SIZE		2352
 #define COOKED_SECTOR_SIZE	2048
 
+/* Sequential image reads fill a ring of readahead windows */
+#define CD_READAHEAD_SIZE	(32*RAW_SECTOR_SIZE)
+#define CD_READAHEAD_SLOTS	4
+
+/* CD audio is decoded this many sectors ahead of the play position */
+#define CD_AUDIO_RING_SECTORS	150
+
 enum { CDROM_USE_SDL, CDROM_USE_ASPI, CDROM_USE_IOCTL_DIO, CDROM_USE_IOCTL_DX, CDROM_USE_IOCTL_MCI };
 
 typedef struct SMSF {
@@ -123,7 +132,19 @@ private:
 		int getLength();
 	private:
 		BinaryFile();
+		bool readCached(Bit8u *buffer, int seek, int count);
+		int readHost(Bit8u *buffer, int seek, int count);
 		std::ifstream *file;
+		/* Set instead of file for compressed images */
+		FILE *packedFile;
+		compressedImage *packed;
+		struct ReadaheadSlot {
+			int start;
+			int len;
+			Bit8u *data;
+		} slots[CD_READAHEAD_SLOTS];
+		int nextSlot;
+		int lastEnd;
 	};
 	
 	#if defined(C_SDL_SOUND)
@@ -176,18 +197,31 @@ static	CDROM_Interface_Image* images[26];
 private:
 	// player
 static	void	CDAudioCallBack(Bitu len);
+static	int	CDAudioThread(void *data);
+static	bool	DecodeAudio(void);
 	int	GetTrack(int sector);
 
 static  struct imagePlayer {
 		CDROM_Interface_Image *cd;
 		MixerChannel   *channel;
 		SDL_mutex 	*mutex;
+		SDL_mutex	*decodeMutex;	// track files and decoder state, taken before mutex
+		SDL_mutex	*fileMutex;	// host file access only, taken last
+		SDL_sem		*wake;
+		SDL_Thread	*thread;
 		Bit8u   buffer[8192];
-		int     bufLen;
+		Bit8u   ring[CD_AUDIO_RING_SECTORS * RAW_SECTOR_SIZE];
+		Bitu    ringStart;
+		Bitu    ringLen;
+		Bitu    frameBytes;	// played part of currFrame
+		Bitu    generation;	// bumped when decoded audio becomes stale
 		int     currFrame;	
+		int     decodeFrame;
 		int     targetFrame;
 		bool    isPlaying;
 		bool    isPaused;
+		bool    decodeDone;
+		bool    quit;
 	} player;
 	
 	void 	ClearTracks();
@@ -200,6 +234,7 @@ static  struct imagePlayer {
 	bool	GetCueFrame(int &frames, std::istream &in);
 	bool	GetCueString(std::string &str, std::istream &in);
 	bool	AddTrack(Track &curr, int &shift, int prestart, int &totalPregap, int currPregap);
+	bool	ReadData(Bit8u *buffer, bool raw, unsigned long sector, unsigned long num);
 
 static	int	refCount;
 	std::vector<Track>	tracks;
@@ -29,6 +29,7 @@
 #include <vector>
 #include <sys/stat.h>
 #include "cdrom.h"
+#include "compressed_image.h"
 #include "drives.h"
 #include "support.h"
 #include "setup.h"
@@ -46,6 +47,25 @@ using namespace std;
 
 CDROM_Interface_Image::BinaryFile::BinaryFile(const char *filename, bool &error)
 {
+	file = NULL;
+	packed = NULL;
+	for (int i = 0; i < CD_READAHEAD_SLOTS; i++) {
+		slots[i].start = 0;
+		slots[i].len = 0;
+		slots[i].data = NULL;
+	}
+	nextSlot = 0;
+	lastEnd = -1;
+	packedFile = fopen(filename, "rb");
+	if (packedFile) {
+		packed = compressedImage::Open(packedFile);
+		if (packed) {
+			error = false;
+			return;
+		}
+		fclose(packedFile);
+		packedFile = NULL;
+	}
 	file = new ifstream(filename, ios::in | ios::binary);
 	error = (file == NULL) || (file->fail());
 }
@@ -53,17 +73,70 @@ CDROM_Interface_Image::BinaryFile::BinaryFile(const char *filename, bool &error)
 CDROM_Interface_Image::BinaryFile::~BinaryFile()
 {
 	delete file;
+	delete packed;
+	if (packedFile) fclose(packedFile);
+	for (int i = 0; i < CD_READAHEAD_SLOTS; i++) delete[] slots[i].data;
 }
 
-bool CDROM_Interface_Image::BinaryFile::read(Bit8u *buffer, int seek, int count)
+int CDROM_Interface_Image::BinaryFile::readHost(Bit8u *buffer, int seek, int count)
 {
+	if (packed) return (int)packed->Read(seek, count, buffer);
+	file->clear();
 	file->seekg(seek, ios::beg);
 	file->read((char*)buffer, count);
-	return !(file->fail());
+	return (int)file->gcount();
+}
+
+bool CDROM_Interface_Image::BinaryFile::read(Bit8u *buffer, int seek, int count)
+{
+	// the readahead windows are shared with the audio thread
+	SDL_mutexP(player.fileMutex);
+	bool success = readCached(buffer, seek, count);
+	SDL_mutexV(player.fileMutex);
+	return success;
+}
+
+bool CDROM_Interface_Image::BinaryFile::readCached(Bit8u *buffer, int seek, int count)
+{
+	bool sequential = (seek == lastEnd);
+	lastEnd = seek + count;
+	while (count > 0) {
+		// serve what the readahead windows already hold
+		int i;
+		for (i = 0; i < CD_READAHEAD_SLOTS; i++) {
+			ReadaheadSlot &slot = slots[i];
+			if (slot.len && seek >= slot.start && seek < slot.start + slot.len) break;
+		}
+		if (i < CD_READAHEAD_SLOTS) {
+			int avail = slots[i].start + slots[i].len - seek;
+			if (avail > count) avail = count;
+			memcpy(buffer, &slots[i].data[seek - slots[i].start], avail);
+			buffer += avail;
+			seek += avail;
+			count -= avail;
+			// running off the end of a window continues a stream
+			sequential = true;
+			continue;
+		}
+		// random and large reads go straight to the file
+		if (!sequential || count >= CD_READAHEAD_SIZE) return readHost(buffer, seek, count) == count;
+		ReadaheadSlot &slot = slots[nextSlot];
+		nextSlot = (nextSlot + 1) % CD_READAHEAD_SLOTS;
+		if (!slot.data) slot.data = new Bit8u[CD_READAHEAD_SIZE];
+		slot.start = seek;
+		slot.len = readHost(slot.data, seek, CD_READAHEAD_SIZE);
+		if (slot.len < count) {
+			slot.len = 0;
+			return false;
+		}
+	}
+	return true;
 }
 
 int CDROM_Interface_Image::BinaryFile::getLength()
 {
+	if (packed) return (int)packed->GetSize();
+	file->clear();
 	file->seekg(0, ios::end);
 	int length = (int)file->tellg();
 	if (file->fail()) return -1;
@@ -71,10 +144,72 @@ int CDROM_Interface_Image::BinaryFile::getLength()
 }
 
 #if defined(C_SDL_SOUND)
+// the decoder reads through these, so only the host file access holds the lock
+struct LockedRW {
+	SDL_RWops *rw;
+	SDL_mutex *lock;
+};
+
+static int LockedRW_Seek(SDL_RWops *context, int offset, int whence)
+{
+	LockedRW *locked = (LockedRW*)context->hidden.unknown.data1;
+	SDL_mutexP(locked->lock);
+	int pos = SDL_RWseek(locked->rw, offset, whence);
+	SDL_mutexV(locked->lock);
+	return pos;
+}
+
+static int LockedRW_Read(SDL_RWops *context, void *ptr, int size, int maxnum)
+{
+	LockedRW *locked = (LockedRW*)context->hidden.unknown.data1;
+	SDL_mutexP(locked->lock);
+	int num = SDL_RWread(locked->rw, ptr, size, maxnum);
+	SDL_mutexV(locked->lock);
+	return num;
+}
+
+static int LockedRW_Write(SDL_RWops * /*context*/, const void * /*ptr*/, int /*size*/, int /*num*/)
+{
+	return -1;
+}
+
+static int LockedRW_Close(SDL_RWops *context)
+{
+	LockedRW *locked = (LockedRW*)context->hidden.unknown.data1;
+	int result = SDL_RWclose(locked->rw);
+	delete locked;
+	SDL_FreeRW(context);
+	return result;
+}
+
+static SDL_RWops *LockedRW_FromFile(const char *filename, SDL_mutex *lock)
+{
+	SDL_RWops *rw = SDL_RWFromFile(filename, "rb");
+	if (!rw) return NULL;
+	SDL_RWops *context = SDL_AllocRW();
+	if (!context) {
+		SDL_RWclose(rw);
+		return NULL;
+	}
+	LockedRW *locked = new LockedRW;
+	locked->rw = rw;
+	locked->lock = lock;
+	context->seek = LockedRW_Seek;
+	context->read = LockedRW_Read;
+	context->write = LockedRW_Write;
+	context->close = LockedRW_Close;
+	context->hidden.unknown.data1 = locked;
+	return context;
+}
+
 CDROM_Interface_Image::AudioFile::AudioFile(const char *filename, bool &error)
 {
 	Sound_AudioInfo desired = {AUDIO_S16, 2, 44100};
-	sample = Sound_NewSampleFromFile(filename, &desired, RAW_SECTOR_SIZE);
+	const char *ext = strrchr(filename, '.');
+	if (ext) ext++;
+	sample = NULL;
+	SDL_RWops *rw = LockedRW_FromFile(filename, player.fileMutex);
+	if (rw) sample = Sound_NewSample(rw, ext, &desired, RAW_SECTOR_SIZE);
 	lastCount = RAW_SECTOR_SIZE;
 	lastSeek = 0;
 	error = (sample == NULL);
@@ -90,6 +225,7 @@ bool CDROM_Interface_Image::AudioFile::read(Bit8u *buffer, int seek, int count)
 	if (lastCount != count) {
 		int success = Sound_SetBufferSize(sample, count);
 		if (!success) return false;
+		lastCount = count;
 	}
 	if (lastSeek != (seek - count)) {
 		int success = Sound_Seek(sample, (int)((double)(seek) / 176.4f));
@@ -131,7 +267,7 @@ int CDROM_Interface_Image::AudioFile::getLength()
 int CDROM_Interface_Image::refCount = 0;
 CDROM_Interface_Image* CDROM_Interface_Image::images[26];
 CDROM_Interface_Image::imagePlayer CDROM_Interface_Image::player = {
-	NULL, NULL, NULL, {0}, 0, 0, 0, false, false };
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, {0}, {0}, 0, 0, 0, 0, 0, 0, 0, false, false, false, false };
 
 	
 CDROM_Interface_Image::CDROM_Interface_Image(Bit8u subUnit)
@@ -139,6 +275,12 @@ CDROM_Interface_Image::CDROM_Interface_Image(Bit8u subUnit)
 	images[subUnit] = this;
 	if (refCount == 0) {
 		player.mutex = SDL_CreateMutex();
+		player.decodeMutex = SDL_CreateMutex();
+		player.fileMutex = SDL_CreateMutex();
+		player.wake = SDL_CreateSemaphore(0);
+		player.quit = false;
+		player.thread = SDL_CreateThread(&CDAudioThread, 0);
+		if (!player.thread) LOG_MSG("CDROM: Can't start audio thread, decoding inline");
 		if (!player.channel) {
 			player.channel = MIXER_AddChannel(&CDAudioCallBack, 44100, "CDAUDIO");
 		}
@@ -150,9 +292,26 @@ CDROM_Interface_Image::CDROM_Interface_Image(Bit8u subUnit)
 CDROM_Interface_Image::~CDROM_Interface_Image()
 {
 	refCount--;
-	if (player.cd == this) player.cd = NULL;
+	SDL_mutexP(player.decodeMutex);
+	SDL_mutexP(player.mutex);
+	if (player.cd == this) {
+		player.cd = NULL;
+		player.isPlaying = false;
+		player.generation++;
+	}
+	SDL_mutexV(player.mutex);
 	ClearTracks();
+	SDL_mutexV(player.decodeMutex);
 	if (refCount == 0) {
+		if (player.thread) {
+			player.quit = true;
+			SDL_SemPost(player.wake);
+			SDL_WaitThread(player.thread, NULL);
+			player.thread = NULL;
+		}
+		SDL_DestroySemaphore(player.wake);
+		SDL_DestroyMutex(player.fileMutex);
+		SDL_DestroyMutex(player.decodeMutex);
 		SDL_DestroyMutex(player.mutex);
 		player.channel->Enable(false);
 	}
@@ -229,9 +388,23 @@ bool CDROM_Interface_Image::PlayAudioSector(unsigned long start,unsigned long le
 {
 	// We might want to do some more checks. E.g valid start and length
 	SDL_mutexP(player.mutex);
+	if (player.cd == this && player.isPlaying && !player.isPaused && start == (unsigned long)player.targetFrame) {
+		// continues the current stream, keep what has been decoded
+		player.targetFrame = start + len;
+		player.decodeDone = false;
+		SDL_mutexV(player.mutex);
+		SDL_SemPost(player.wake);
+		return true;
+	}
 	player.cd = this;
 	player.currFrame = start;
+	player.decodeFrame = start;
 	player.targetFrame = start + len;
+	player.ringStart = 0;
+	player.ringLen = 0;
+	player.frameBytes = 0;
+	player.decodeDone = false;
+	player.generation++;
 	int track = GetTrack(start) - 1;
 	if(track >= 0 && tracks[track].attr == 0x40) {
 		LOG(LOG_MISC,LOG_WARN)("Game tries to play the data track. Not doing this");
@@ -242,6 +415,7 @@ bool CDROM_Interface_Image::PlayAudioSector(unsigned long start,unsigned long le
 	} else player.isPlaying = true;
 	player.isPaused = false;
 	SDL_mutexV(player.mutex);
+	SDL_SemPost(player.wake);
 	return true;
 }
 
@@ -266,9 +440,26 @@ bool CDROM_Interface_Image::ReadSectors(PhysPt buffer, bool raw, unsigned long s
 	Bit8u* buf = new Bit8u[buflen];
 	
 	bool success = true; //Gobliiins reads 0 sectors
-	for(unsigned long i = 0; i < num; i++) {
-		success = ReadSector(&buf[i * sectorSize], raw, sector + i);
+	for(unsigned long i = 0; i < num;) {
+		// one host read for each run of sectors within a track
+		int track = GetTrack(sector + i) - 1;
+		if (track < 0) {
+			success = false;
+			break;
+		}
+		unsigned long run = 1;
+		if (tracks[track].attr == 0x40) {
+			run = tracks[track + 1].start - (sector + i);
+			if (run > num - i) run = num - i;
+			success = ReadData(&buf[i * sectorSize], raw, sector + i, run);
+		} else {
+			// audio tracks share the decoder with the audio thread
+			SDL_mutexP(player.decodeMutex);
+			success = ReadData(&buf[i * sectorSize], raw, sector + i, run);
+			SDL_mutexV(player.decodeMutex);
+		}
 		if (!success) break;
+		i += run;
 	}
 
 	MEM_BlockWrite(buffer, buf, buflen);
@@ -297,6 +488,16 @@ int CDROM_Interface_Image::GetTrack(int sector)
 }
 
 bool CDROM_Interface_Image::ReadSector(Bit8u *buffer, bool raw, unsigned long sector)
+{
+	int track = GetTrack(sector) - 1;
+	if (track >= 0 && tracks[track].attr == 0x40) return ReadData(buffer, raw, sector, 1);
+	SDL_mutexP(player.decodeMutex);
+	bool success = ReadData(buffer, raw, sector, 1);
+	SDL_mutexV(player.decodeMutex);
+	return success;
+}
+
+bool CDROM_Interface_Image::ReadData(Bit8u *buffer, bool raw, unsigned long sector, unsigned long num)
 {
 	int track = GetTrack(sector) - 1;
 	if (track < 0) return false;
@@ -307,7 +508,68 @@ bool CDROM_Interface_Image::ReadSector(Bit8u *buffer, bool raw, unsigned long se
 	if (tracks[track].sectorSize == RAW_SECTOR_SIZE && !tracks[track].mode2 && !raw) seek += 16;
 	if (tracks[track].mode2 && !raw) seek += 24;
 
-	return tracks[track].file->read(buffer, seek, length);
+	if (num == 1 || tracks[track].sectorSize == length)
+		return tracks[track].file->read(buffer, seek, length * num);
+
+	// cooked reads from raw sectors take the whole span and strip the headers
+	int span = (num - 1) * tracks[track].sectorSize + length;
+	Bit8u *raws = new Bit8u[span];
+	bool success = tracks[track].file->read(raws, seek, span);
+	if (success) {
+		for (unsigned long i = 0; i < num; i++)
+			memcpy(&buffer[i * length], &raws[i * tracks[track].sectorSize], length);
+	}
+	delete[] raws;
+	return success;
+}
+
+bool CDROM_Interface_Image::DecodeAudio(void)
+{
+	Bit8u sector[RAW_SECTOR_SIZE];
+	SDL_mutexP(player.decodeMutex);
+	SDL_mutexP(player.mutex);
+	CDROM_Interface_Image *cd = player.cd;
+	int frame = player.decodeFrame;
+	int target = player.targetFrame;
+	Bitu generation = player.generation;
+	bool work = cd && player.isPlaying && !player.decodeDone &&
+		(player.ringLen + RAW_SECTOR_SIZE <= sizeof(player.ring));
+	bool success = frame < target;
+	SDL_mutexV(player.mutex);
+	if (!work) {
+		SDL_mutexV(player.decodeMutex);
+		return false;
+	}
+	// decode into the private buffer, only the host reads below take fileMutex
+	if (success) success = cd->ReadData(sector, true, frame, 1);
+	SDL_mutexV(player.decodeMutex);
+
+	SDL_mutexP(player.mutex);
+	if (generation == player.generation) {
+		if (success) {
+			Bitu pos = (player.ringStart + player.ringLen) % sizeof(player.ring);
+			memcpy(&player.ring[pos], sector, RAW_SECTOR_SIZE);
+			player.ringLen += RAW_SECTOR_SIZE;
+			player.decodeFrame++;
+		} else if (frame < target || target == player.targetFrame) {
+			// read error or end reached, unless PlayAudioSector extended it meanwhile
+			player.decodeDone = true;
+		}
+	}
+	SDL_mutexV(player.mutex);
+	return true;
+}
+
+int CDROM_Interface_Image::CDAudioThread(void * /*data*/)
+{
+	for (;;) {
+		SDL_SemWait(player.wake);
+		if (player.quit) break;
+		while (DecodeAudio()) {
+			if (player.quit) break;
+		}
+	}
+	return 0;
 }
 
 void CDROM_Interface_Image::CDAudioCallBack(Bitu len)
@@ -318,31 +580,39 @@ void CDROM_Interface_Image::CDAudioCallBack(Bitu len)
 		player.channel->AddSilence();
 		return;
 	}
+	if (len > sizeof(player.buffer)) len = sizeof(player.buffer);
+	if (!player.thread) {
+		while (player.ringLen < len && DecodeAudio()) {}
+	}
 	
 	SDL_mutexP(player.mutex);
-	while (player.bufLen < (Bits)len) {
-		bool success;
-		if (player.targetFrame > player.currFrame)
-			success = player.cd->ReadSector(&player.buffer[player.bufLen], true, player.currFrame);
-		else success = false;
-		
-		if (success) {
-			player.currFrame++;
-			player.bufLen += RAW_SECTOR_SIZE;
-		} else {
-			memset(&player.buffer[player.bufLen], 0, len - player.bufLen);
-			player.bufLen = len;
-			player.isPlaying = false;
-		}
+	Bitu copied = 0;
+	while (copied < len && player.ringLen) {
+		// decoded sectors never straddle the ring end, copies may wrap
+		Bitu chunk = sizeof(player.ring) - player.ringStart;
+		if (chunk > player.ringLen) chunk = player.ringLen;
+		if (chunk > len - copied) chunk = len - copied;
+		memcpy(&player.buffer[copied], &player.ring[player.ringStart], chunk);
+		player.ringStart = (player.ringStart + chunk) % sizeof(player.ring);
+		player.ringLen -= chunk;
+		copied += chunk;
+	}
+	player.frameBytes += copied;
+	player.currFrame += player.frameBytes / RAW_SECTOR_SIZE;
+	player.frameBytes %= RAW_SECTOR_SIZE;
+	if (copied < len) {
+		memset(&player.buffer[copied], 0, len - copied);
+		if (player.decodeDone) player.isPlaying = false;
+		else LOG(LOG_MISC,LOG_NORMAL)("CDROM: audio decoding fell behind by %d bytes", len - copied);
 	}
+	bool refill = !player.decodeDone;
 	SDL_mutexV(player.mutex);
+	if (refill && player.thread) SDL_SemPost(player.wake);
 #if defined(WORDS_BIGENDIAN)
 	player.channel->AddSamples_s16_nonnative(len/4,(Bit16s *)player.buffer);
 #else
 	player.channel->AddSamples_s16(len/4,(Bit16s *)player.buffer);
 #endif
-	memmove(player.buffer, &player.buffer[len], player.bufLen - len);
-	player.bufLen -= len;
 }
 
 bool CDROM_Interface_Image::LoadIsoFile(char* filename)
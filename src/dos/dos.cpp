@@ -31,6 +31,7 @@
 #include "setup.h"
 #include "support.h"
 #include "serialport.h"
+#include "bios_disk.h"
 
 DOS_Block dos;
 DOS_InfoBlock dos_infoblock;
@@ -255,7 +256,8 @@ static Bitu DOS_21Handler(void) {
 //TODO Find out the values for when reg_al!=0
 //TODO Hope this doesn't do anything special
 	case 0x0d:		/* Disk Reset */
-//Sure let's reset a virtual disk
+		/* Get cached writes onto disk images */
+		BIOS_FlushDisks();
 		break;	
 	case 0x0e:		/* Select Default Drive */
 		DOS_SetDefaultDrive(reg_dl);
@@ -575,8 +577,9 @@ static Bitu DOS_21Handler(void) {
 		{ 
 			Bit16u toread=reg_cx;
 			dos.echo=true;
-			if (DOS_ReadFile(reg_bx,dos_copybuf,&toread)) {
-				MEM_BlockWrite(SegPhys(ds)+reg_dx,dos_copybuf,toread);
+			HostPt direct=DOS_IsFileHandle(reg_bx) ? MEM_GetBlockWritePt(SegPhys(ds)+reg_dx,toread) : 0;
+			if (DOS_ReadFile(reg_bx,direct ? direct : dos_copybuf,&toread)) {
+				if (!direct) MEM_BlockWrite(SegPhys(ds)+reg_dx,dos_copybuf,toread);
 				reg_ax=toread;
 				CALLBACK_SCF(false);
 			} else {
@@ -590,8 +593,9 @@ static Bitu DOS_21Handler(void) {
 	case 0x40:					/* WRITE Write to file or device */
 		{
 			Bit16u towrite=reg_cx;
-			MEM_BlockRead(SegPhys(ds)+reg_dx,dos_copybuf,towrite);
-			if (DOS_WriteFile(reg_bx,dos_copybuf,&towrite)) {
+			HostPt direct=DOS_IsFileHandle(reg_bx) ? MEM_GetBlockReadPt(SegPhys(ds)+reg_dx,towrite) : 0;
+			if (!direct) MEM_BlockRead(SegPhys(ds)+reg_dx,dos_copybuf,towrite);
+			if (DOS_WriteFile(reg_bx,direct ? direct : dos_copybuf,&towrite)) {
 				reg_ax=towrite;
 	   			CALLBACK_SCF(false);
 			} else {
@@ -1024,6 +1028,7 @@ static Bitu DOS_21Handler(void) {
 		};
 	case 0x68:                  /* FFLUSH Commit file */
 		if(DOS_FlushFile(reg_bl)) {
+			BIOS_FlushDisks();
 			CALLBACK_SCF(false);
 		} else {
 			reg_ax = dos.errorcode;
@@ -373,6 +373,13 @@ bool DOS_ReadFile(Bit16u entry,Bit8u * data,Bit16u * amount) {
 	return ret;
 }
 
+/* Open handle of a file, devices can run guest code during a transfer */
+bool DOS_IsFileHandle(Bit16u entry) {
+	Bit32u handle=RealHandle(entry);
+	if (handle>=DOS_FILES || !Files[handle] || !Files[handle]->IsOpen()) return false;
+	return (Files[handle]->GetInformation() & 0x80)==0;
+}
+
 bool DOS_WriteFile(Bit16u entry,Bit8u * data,Bit16u * amount) {
 	Bit32u handle=RealHandle(entry);
 	if (handle>=DOS_FILES) {
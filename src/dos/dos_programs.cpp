@@ -36,6 +36,7 @@
 #include "bios.h"
 #include "setup.h"
 #include "control.h"
+#include "compressed_image.h"
 
 
 #if defined(OS2)
@@ -118,6 +119,12 @@ public:
 		std::string type="dir";
 		cmd->FindString("-t",type,true);
 		bool iscdrom = (type =="cdrom"); //Used for mscdex bug cdrom label name emulation
+		/* Keep the directory untouched and write changes to another one */
+		std::string overlay;
+		cmd->FindString("-overlay",overlay,true);
+		/* Keep the directory listings between sessions */
+		std::string dircache;
+		cmd->FindString("-dircache",dircache,true);
 		if (type=="floppy" || type=="dir" || type=="cdrom") {
 			Bit16u sizes[4];
 			Bit8u mediaid;
@@ -291,7 +298,15 @@ public:
 #else
 				if(temp_line == "/") WriteOut(MSG_Get("PROGRAM_MOUNT_WARNING_OTHER"));
 #endif
-				newdrive=new localDrive(temp_line.c_str(),sizes[0],bit8size,sizes[2],sizes[3],mediaid);
+				if (overlay.size()) {
+					Cross::ResolveHomedir(overlay);
+					if (stat(overlay.c_str(),&test) || !(test.st_mode & S_IFDIR)) {
+						WriteOut(MSG_Get("PROGRAM_MOUNT_OVERLAY_ERROR"),overlay.c_str());
+						return;
+					}
+					if (overlay[overlay.size()-1]!=CROSS_FILESPLIT) overlay+=CROSS_FILESPLIT;
+					newdrive=new overlayDrive(temp_line.c_str(),overlay.c_str(),sizes[0],bit8size,sizes[2],sizes[3],mediaid);
+				} else newdrive=new localDrive(temp_line.c_str(),sizes[0],bit8size,sizes[2],sizes[3],mediaid);
 			}
 		} else {
 			WriteOut(MSG_Get("PROGRAM_MOUNT_ILL_TYPE"),type.c_str());
@@ -319,6 +334,10 @@ public:
 			label = drive; label += "_FLOPPY";
 			newdrive->dirCache.SetLabel(label.c_str(),iscdrom,true);
 		}
+		if (dircache.size()) {
+			Cross::ResolveHomedir(dircache);
+			newdrive->dirCache.SetCacheFile(dircache.c_str());
+		}
 		return;
 showusage:
 #if defined (WIN32) || defined(OS2)
@@ -431,9 +450,8 @@ private:
 			}
 
 			// get file size
-			fseek(tmpfile,0L, SEEK_END);
-			*ksize = (ftell(tmpfile) / 1024);
-			*bsize = ftell(tmpfile);
+			*bsize = (Bit32u)compressedImage::ImageSize(tmpfile);
+			*ksize = (*bsize / 1024);
 			fclose(tmpfile);
 
 			tmpfile = ldp->GetSystemFilePtr(fullname, "rb+");
@@ -455,8 +473,9 @@ private:
 		}
 	}
    
-	FILE *getFSFile(char const * filename, Bit32u *ksize, Bit32u *bsize,bool tryload=false) {
+	FILE *getFSFile(char const * filename, Bit32u *ksize, Bit32u *bsize,bool *readonly,bool tryload=false) {
 		Bit8u error = tryload?1:0;
+		*readonly = false;
 		FILE* tmpfile = getFSFile_mounted(filename,ksize,bsize,&error);
 		if(tmpfile) return tmpfile;
 		//File not found on mounted filesystem. Try regular filesystem
@@ -469,9 +488,9 @@ private:
 //				fclose(tmpfile);
 //				if(tryload) error = 2;
 				WriteOut(MSG_Get("PROGRAM_BOOT_WRITE_PROTECTED"));
-				fseek(tmpfile,0L, SEEK_END);
-				*ksize = (ftell(tmpfile) / 1024);
-				*bsize = ftell(tmpfile);
+				*readonly = true;
+				*bsize = (Bit32u)compressedImage::ImageSize(tmpfile);
+				*ksize = (*bsize / 1024);
 				return tmpfile;
 			}
 			// Give the delayed errormessages from the mounted variant (or from above)
@@ -479,9 +498,8 @@ private:
 			if(error == 2) WriteOut(MSG_Get("PROGRAM_BOOT_NOT_OPEN"));
 			return NULL;
 		}
-		fseek(tmpfile,0L, SEEK_END);
-		*ksize = (ftell(tmpfile) / 1024);
-		*bsize = ftell(tmpfile);
+		*bsize = (Bit32u)compressedImage::ImageSize(tmpfile);
+		*ksize = (*bsize / 1024);
 		return tmpfile;
 	}
 
@@ -563,10 +581,11 @@ public:
 
 				WriteOut(MSG_Get("PROGRAM_BOOT_IMAGE_OPEN"), temp_line.c_str());
 				Bit32u rombytesize;
-				FILE *usefile = getFSFile(temp_line.c_str(), &floppysize, &rombytesize);
+				bool readonly;
+				FILE *usefile = getFSFile(temp_line.c_str(), &floppysize, &rombytesize, &readonly);
 				if(usefile != NULL) {
 					if(diskSwap[i] != NULL) delete diskSwap[i];
-					diskSwap[i] = new imageDisk(usefile, (Bit8u *)temp_line.c_str(), floppysize, false);
+					diskSwap[i] = new imageDisk(usefile, (Bit8u *)temp_line.c_str(), floppysize, false, readonly);
 					if (usefile_1==NULL) {
 						usefile_1=usefile;
 						rombytesize_1=rombytesize;
@@ -676,7 +695,8 @@ public:
 				if (usefile_1==NULL) return;
 
 				Bit32u sz1,sz2;
-				FILE *tfile = getFSFile("system.rom", &sz1, &sz2, true);
+				bool romreadonly;
+				FILE *tfile = getFSFile("system.rom", &sz1, &sz2, &romreadonly, true);
 				if (tfile!=NULL) {
 					fseek(tfile, 0x3000L, SEEK_SET);
 					Bit32u drd=(Bit32u)fread(rombuf, 1, 0xb000, tfile);
@@ -1015,6 +1035,9 @@ public:
 		cmd->FindString("-t",type,true);
 		cmd->FindString("-fs",fstype,true);
 		if(type == "cdrom") type = "iso"; //Tiny hack for people who like to type -t cdrom
+		/* Delta file that receives the writes, the image is only read */
+		std::string overlay;
+		if (cmd->FindString("-overlay",overlay,true)) Cross::ResolveHomedir(overlay);
 		Bit8u mediaid;
 		if (type=="floppy" || type=="hdd" || type=="iso") {
 			Bit16u sizes[4];
@@ -1130,16 +1153,26 @@ public:
 
 			if(fstype=="fat") {
 				if (imgsizedetect) {
-					FILE * diskfile = fopen(temp_line.c_str(), "rb+");
+					FILE * diskfile = fopen(temp_line.c_str(), overlay.size() ? "rb" : "rb+");
 					if(!diskfile) {
 						WriteOut(MSG_Get("PROGRAM_IMGMOUNT_INVALID_IMAGE"));
 						return;
 					}
-					fseek(diskfile, 0L, SEEK_END);
-					Bit32u fcsize = (Bit32u)(ftell(diskfile) / 512L);
+					Bit32u fcsize;
 					Bit8u buf[512];
-					fseek(diskfile, 0L, SEEK_SET);
-					if (fread(buf,sizeof(Bit8u),512,diskfile)<512) {
+					Bitu got;
+					compressedImage * packed = compressedImage::Open(diskfile);
+					if (packed) {
+						fcsize = (Bit32u)(packed->GetSize() / 512L);
+						got = packed->Read(0, 512, buf);
+						delete packed;
+					} else {
+						fseek(diskfile, 0L, SEEK_END);
+						fcsize = (Bit32u)(ftell(diskfile) / 512L);
+						fseek(diskfile, 0L, SEEK_SET);
+						got = fread(buf,sizeof(Bit8u),512,diskfile);
+					}
+					if (got<512) {
 						fclose(diskfile);
 						WriteOut(MSG_Get("PROGRAM_IMGMOUNT_INVALID_IMAGE"));
 						return;
@@ -1158,19 +1191,23 @@ public:
 					LOG_MSG("autosized image file: %d:%d:%d:%d",sizes[0],sizes[1],sizes[2],sizes[3]);
 				}
 
-				newdrive=new fatDrive(temp_line.c_str(),sizes[0],sizes[1],sizes[2],sizes[3],0);
+				newdrive=new fatDrive(temp_line.c_str(),sizes[0],sizes[1],sizes[2],sizes[3],0,overlay.size() ? overlay.c_str() : 0);
 				if(!(dynamic_cast<fatDrive*>(newdrive))->created_successfully) {
 					delete newdrive;
 					newdrive = 0;
 				}
 			} else if (fstype=="iso") {
 			} else {
-				FILE *newDisk = fopen(temp_line.c_str(), "rb+");
-				fseek(newDisk,0L, SEEK_END);
-				imagesize = (ftell(newDisk) / 1024);
+				FILE *newDisk = fopen(temp_line.c_str(), overlay.size() ? "rb" : "rb+");
+				imagesize = (Bit32u)(compressedImage::ImageSize(newDisk) / 1024);
 
-				newImage = new imageDisk(newDisk, (Bit8u *)temp_line.c_str(), imagesize, (imagesize > 2880));
+				newImage = new imageDisk(newDisk, (Bit8u *)temp_line.c_str(), imagesize, (imagesize > 2880), overlay.size() != 0);
 				if(imagesize>2880) newImage->Set_Geometry(sizes[2],sizes[3],sizes[1],sizes[0]);
+				if(overlay.size() && !newImage->SetOverlay(overlay.c_str())) {
+					delete newImage;
+					WriteOut(MSG_Get("PROGRAM_IMGMOUNT_OVERLAY_INVALID"),overlay.c_str());
+					return;
+				}
 			}
 		} else {
 			WriteOut(MSG_Get("PROGRAM_IMGMOUNT_TYPE_UNSUPPORTED"),type.c_str());
@@ -1363,11 +1400,14 @@ void DOS_SetupPrograms(void) {
 		"Usage \033[34;1mMOUNT Drive-Letter Local-Directory\033[0m\n"
 		"For example: MOUNT c %s\n"
 		"This makes the directory %s act as the C: drive inside DOSBox.\n"
-		"The directory has to exist.\n");
+		"The directory has to exist.\n"
+		"Add -overlay Directory to send all changes to that directory instead.\n"
+		"Add -dircache File to keep the directory listings in that file for the next mount.\n");
 	MSG_Add("PROGRAM_MOUNT_UMOUNT_NOT_MOUNTED","Drive %c isn't mounted.\n");
 	MSG_Add("PROGRAM_MOUNT_UMOUNT_SUCCESS","Drive %c has successfully been removed.\n");
 	MSG_Add("PROGRAM_MOUNT_UMOUNT_NO_VIRTUAL","Virtual Drives can not be unMOUNTed.\n");
 	MSG_Add("PROGRAM_MOUNT_WARNING_WIN","\033[31;1mMounting c:\\ is NOT recommended. Please mount a (sub)directory next time.\033[0m\n");
+	MSG_Add("PROGRAM_MOUNT_OVERLAY_ERROR","Overlay directory %s doesn't exist.\n");
 	MSG_Add("PROGRAM_MOUNT_WARNING_OTHER","\033[31;1mMounting / is NOT recommended. Please mount a (sub)directory next time.\033[0m\n");
 
 	MSG_Add("PROGRAM_MEM_CONVEN","%10d Kb free conventional memory\n");
@@ -1526,6 +1566,7 @@ void DOS_SetupPrograms(void) {
 	MSG_Add("PROGRAM_IMGMOUNT_MOUNT","To mount directories, use the \033[34;1mMOUNT\033[0m command, not the \033[34;1mIMGMOUNT\033[0m command.\n");
 	MSG_Add("PROGRAM_IMGMOUNT_ALREADY_MOUNTED","Drive already mounted at that letter.\n");
 	MSG_Add("PROGRAM_IMGMOUNT_CANT_CREATE","Can't create drive from file.\n");
+	MSG_Add("PROGRAM_IMGMOUNT_OVERLAY_INVALID","Could not use %s as overlay file.\n");
 	MSG_Add("PROGRAM_IMGMOUNT_MOUNT_NUMBER","Drive number %d mounted as %s\n");
 	MSG_Add("PROGRAM_IMGMOUNT_NON_LOCAL_DRIVE", "The image must be on a host or local drive.\n");
 	MSG_Add("PROGRAM_IMGMOUNT_MULTIPLE_NON_CUEISO_FILES", "Using multiple files is only supported for cue/iso images.\n");
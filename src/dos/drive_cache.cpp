@@ -25,8 +25,13 @@
 
 // STL stuff
 #include <vector>
+#include <set>
+#include <string>
 #include <iterator>
 #include <algorithm>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #if defined (WIN32)   /* Win 32 */
 #define WIN32_LEAN_AND_MEAN        // Exclude rarely-used stuff from 
@@ -39,6 +44,18 @@
 #include <os2.h>
 #endif
 
+#if defined (LINUX)
+#include <sys/inotify.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* Layout of the -dircache file: the id, base and overlay path, then
+   the directory tree in preorder. A directory is its stamp and entry
+   count followed by the entries, each cached subdirectory directly
+   after its own entry. */
+#define DIRCACHE_FILE_ID "DOSBox dircache 1"
+
 int fileInfoCounter = 0;
 
 bool SortByName(DOS_Drive_Cache::CFileInfo* const &a, DOS_Drive_Cache::CFileInfo* const &b) {
@@ -66,10 +83,13 @@ DOS_Drive_Cache::DOS_Drive_Cache(void) {
 	save_dir		= 0;
 	srchNr			= 0;
 	label[0]		= 0;
+	overlayPath[0]	= 0;
 	nextFreeFindFirst	= 0;
 	for (Bit32u i=0; i<MAX_OPENDIRS; i++) { dirSearch[i] = 0; free[i] = true; dirFindFirst[i] = 0; };
 	SetDirSort(DIRALPHABETICAL);
 	updatelabel = true;
+	cacheFile[0]	= 0;
+	notifyFd		= -1;
 }
 
 DOS_Drive_Cache::DOS_Drive_Cache(const char* path) {
@@ -77,25 +97,35 @@ DOS_Drive_Cache::DOS_Drive_Cache(const char* path) {
 	save_dir		= 0;
 	srchNr			= 0;
 	label[0]		= 0;
+	overlayPath[0]	= 0;
 	nextFreeFindFirst	= 0;
 	for (Bit32u i=0; i<MAX_OPENDIRS; i++) { dirSearch[i] = 0; free[i] = true; dirFindFirst[i] = 0; };
 	SetDirSort(DIRALPHABETICAL);
+	cacheFile[0]	= 0;
+	notifyFd		= -1;
 	SetBaseDir(path);
 	updatelabel = true;
 }
 
 DOS_Drive_Cache::~DOS_Drive_Cache(void) {
+	SaveCacheFile();
 	Clear();
 	for (Bit32u i=0; i<MAX_OPENDIRS; i++) { delete dirFindFirst[i]; dirFindFirst[i]=0; };
 }
 
 void DOS_Drive_Cache::Clear(void) {
+#if defined (LINUX)
+	// closing the descriptor drops all watches
+	if (notifyFd>=0) close(notifyFd);
+	notifyFd = -1;
+#endif
+	watches.clear();
 	delete dirBase; dirBase = 0;
 	nextFreeFindFirst	= 0;
 	for (Bit32u i=0; i<MAX_OPENDIRS; i++) dirSearch[i] = 0;
 }
 
-void DOS_Drive_Cache::EmptyCache(void) {
+void DOS_Drive_Cache::ResetCache(void) {
 	// Empty Cache and reinit
 	Clear();
 	dirBase		= new CFileInfo;
@@ -105,6 +135,256 @@ void DOS_Drive_Cache::EmptyCache(void) {
 	SetBaseDir(basePath);
 }
 
+void DOS_Drive_Cache::EmptyCache(void) {
+	// Only directories that changed on the host are read again
+	ReadEvents();
+	RefreshDir(dirBase,basePath);
+	nextFreeFindFirst	= 0;
+	save_dir	= 0;
+	srchNr		= 0;
+	for (Bit32u i=0; i<MAX_OPENDIRS; i++) { dirSearch[i] = 0; free[i] = true; }
+	SetBaseDir(basePath);
+}
+
+void DOS_Drive_Cache::SetOverlayDir(const char* path) {
+	strcpy(overlayPath,path);
+	ResetCache();
+}
+
+Bit64u DOS_Drive_Cache::GetDirStamp(const char* path) {
+	char dirName[CROSS_LEN];
+	char overlayDir[CROSS_LEN];
+	Bit32u times[2] = { 0, 0 };
+	time_t now = time(NULL);
+	for (Bitu i=0; i<2; i++) {
+		if (i==0) safe_strncpy(dirName,path,CROSS_LEN);
+		else if (OverlayName(path,overlayDir)) safe_strncpy(dirName,overlayDir,CROSS_LEN);
+		else break;
+		size_t len = strlen(dirName);
+		if ((len>1) && (dirName[len-1]==CROSS_FILESPLIT) && (dirName[len-2]!=':')) dirName[len-1] = 0;
+		struct stat status;
+		if (stat(dirName,&status)) continue;
+		// a change within the same second could go unnoticed
+		if (status.st_mtime+1>=now) return 0;
+		times[i] = (Bit32u)status.st_mtime;
+	}
+	return ((Bit64u)times[0]<<32) | times[1];
+}
+
+void DOS_Drive_Cache::WatchDir(CFileInfo* dir, const char* path) {
+#if defined (LINUX)
+	// overlay drives have two host directories, use the stamp for them
+	if ((dir->watch>=0) || overlayPath[0]) return;
+	if (notifyFd<0) {
+		notifyFd = inotify_init();
+		if (notifyFd<0) return;
+		fcntl(notifyFd,F_SETFL,O_NONBLOCK);
+	}
+	int wd = inotify_add_watch(notifyFd,path,IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR);
+	// "." and ".." entries share the watch of the directory they point to
+	if ((wd<0) || watches.count(wd)) return;
+	watches[wd] = dir;
+	dir->watch = wd;
+#endif
+}
+
+void DOS_Drive_Cache::UnwatchDir(CFileInfo* dir) {
+#if defined (LINUX)
+	if (dir->watch<0) return;
+	inotify_rm_watch(notifyFd,dir->watch);
+	watches.erase(dir->watch);
+	dir->watch = -1;
+#endif
+}
+
+void DOS_Drive_Cache::ReadEvents(void) {
+#if defined (LINUX)
+	if (notifyFd<0) return;
+	Bit32u buffer[1024];
+	bool overflow = false;
+	ssize_t len;
+	while ((len = read(notifyFd,buffer,sizeof(buffer)))>0) {
+		char* pos = (char*)buffer;
+		while (pos<(char*)buffer+len) {
+			struct inotify_event* event = (struct inotify_event*)pos;
+			if (event->mask & IN_Q_OVERFLOW) overflow = true;
+			else {
+				std::map<int,CFileInfo*>::iterator it = watches.find(event->wd);
+				if (it!=watches.end()) {
+					it->second->stamp = 0;
+					if (event->mask & IN_IGNORED) {
+						it->second->watch = -1;
+						watches.erase(it);
+					}
+				}
+			}
+			pos += sizeof(struct inotify_event)+event->len;
+		}
+	}
+	if (overflow) {
+		std::map<int,CFileInfo*>::iterator it;
+		for (it=watches.begin(); it!=watches.end(); ++it) it->second->stamp = 0;
+	}
+#endif
+}
+
+void DOS_Drive_Cache::RefreshDir(CFileInfo* dir, const char* path) {
+	if (!IsCachedIn(dir)) return;
+	bool changed = (dir->stamp==0);
+	if (!changed && (dir->watch<0)) {
+		// loaded or unwatched directory, check it against the host
+		WatchDir(dir,path);
+		changed = (GetDirStamp(path)!=dir->stamp);
+	}
+	if (changed) {
+		DropContents(dir);
+		return;
+	}
+	char subDir[CROSS_LEN];
+	size_t len = strlen(path);
+	for (Bitu i=0; i<dir->fileList.size(); i++) {
+		CFileInfo* info = dir->fileList[i];
+		if (!info->isDir || !IsCachedIn(info)) continue;
+		if (len+strlen(info->orgname)+2>CROSS_LEN) {
+			DropContents(info);
+			continue;
+		}
+		strcpy(subDir,path);
+		strcat(subDir,info->orgname);
+		subDir[len+strlen(info->orgname)] = CROSS_FILESPLIT;
+		subDir[len+strlen(info->orgname)+1] = 0;
+		RefreshDir(info,subDir);
+	}
+}
+
+void DOS_Drive_Cache::DropContents(CFileInfo* dir) {
+	for (Bitu i=0; i<dir->fileList.size(); i++) {
+		CFileInfo* info = dir->fileList[i];
+		if (info->isDir) {
+			DropContents(info);
+			UnwatchDir(info);
+		}
+		delete info;
+	}
+	dir->fileList.clear();
+	dir->shortHash.clear();
+	dir->longHash.clear();
+	dir->shortNrs.clear();
+}
+
+static bool WriteName(FILE* file, const char* name) {
+	Bit8u len[2];
+	size_t size = strlen(name);
+	host_writew(len,(Bit16u)size);
+	return (fwrite(len,1,2,file)==2) && (fwrite(name,1,size,file)==size);
+}
+
+static bool ReadName(FILE* file, char* name, size_t maxlen) {
+	Bit8u len[2];
+	if (fread(len,1,2,file)!=2) return false;
+	size_t size = host_readw(len);
+	if (size>=maxlen) return false;
+	if (fread(name,1,size,file)!=size) return false;
+	name[size] = 0;
+	return true;
+}
+
+bool DOS_Drive_Cache::SaveDir(FILE* file, CFileInfo* dir) {
+	Bit8u data[12];
+	Bit64u stamp = IsCachedIn(dir) ? dir->stamp : 0;
+	Bit32u count = stamp ? (Bit32u)dir->fileList.size() : 0;
+	host_writed(&data[0],(Bit32u)stamp);
+	host_writed(&data[4],(Bit32u)(stamp>>32));
+	host_writed(&data[8],count);
+	if (fwrite(data,1,12,file)!=12) return false;
+	for (Bit32u i=0; i<count; i++) {
+		CFileInfo* info = dir->fileList[i];
+		data[0] = info->isDir ? 1 : 0;
+		host_writed(&data[1],(Bit32u)info->shortNr);
+		if (fwrite(data,1,5,file)!=5) return false;
+		if (!WriteName(file,info->orgname) || !WriteName(file,info->shortname)) return false;
+		if (info->isDir && !SaveDir(file,info)) return false;
+	}
+	return true;
+}
+
+bool DOS_Drive_Cache::LoadDir(FILE* file, CFileInfo* dir) {
+	Bit8u data[12];
+	if (fread(data,1,12,file)!=12) return false;
+	dir->stamp = host_readd(&data[0]) | ((Bit64u)host_readd(&data[4])<<32);
+	Bit32u count = host_readd(&data[8]);
+	for (Bit32u i=0; i<count; i++) {
+		CFileInfo* info = new CFileInfo;
+		// the entries were saved in fileList order
+		dir->fileList.push_back(info);
+		if (fread(data,1,5,file)!=5) return false;
+		info->isDir = (data[0]!=0);
+		info->shortNr = host_readd(&data[1]);
+		if (!ReadName(file,info->orgname,CROSS_LEN) || !ReadName(file,info->shortname,DOS_NAMELENGTH_ASCII)) return false;
+		AddToIndex(dir,info);
+		if (info->shortNr) {
+			// numbering of new names continues after the loaded ones
+			char tmpNameBuffer[CROSS_LEN];
+			char* tmpName = tmpNameBuffer;
+			Bits len;
+			strcpy(tmpName,info->orgname);
+			ShortNameBase(tmpName,len);
+			Bitu& lastNr = dir->shortNrs[std::string(tmpName,len<6 ? len : 6)];
+			if (info->shortNr > lastNr) lastNr = info->shortNr;
+		}
+		if (info->isDir && !LoadDir(file,info)) return false;
+	}
+	return true;
+}
+
+void DOS_Drive_Cache::SetCacheFile(const char* file) {
+	safe_strncpy(cacheFile,file,CROSS_LEN);
+	FILE* f = fopen(cacheFile,"rb");
+	if (!f) return;
+	char id[CROSS_LEN];
+	char base[CROSS_LEN];
+	char overlay[CROSS_LEN];
+	// only use it for the same directories
+	bool ok = ReadName(f,id,CROSS_LEN) && !strcmp(id,DIRCACHE_FILE_ID) &&
+		ReadName(f,base,CROSS_LEN) && !strcmp(base,basePath) &&
+		ReadName(f,overlay,CROSS_LEN) && !strcmp(overlay,overlayPath);
+	if (ok) {
+		DropContents(dirBase);
+		ok = LoadDir(f,dirBase);
+	}
+	fclose(f);
+	if (!ok) {
+		LOG(LOG_DOSMISC,LOG_NORMAL)("DIRCACHE: Ignoring %s",cacheFile);
+		DropContents(dirBase);
+	}
+	// drop what changed since the file was written
+	EmptyCache();
+}
+
+void DOS_Drive_Cache::SaveCacheFile(void) {
+	if (!cacheFile[0] || !dirBase) return;
+	ReadEvents();
+	FILE* f = fopen(cacheFile,"wb");
+	if (!f) {
+		LOG_MSG("DIRCACHE: Can't create %s",cacheFile);
+		return;
+	}
+	bool ok = WriteName(f,DIRCACHE_FILE_ID) && WriteName(f,basePath) &&
+		WriteName(f,overlayPath) && SaveDir(f,dirBase);
+	if (fclose(f) || !ok) {
+		LOG_MSG("DIRCACHE: Error writing %s",cacheFile);
+		remove(cacheFile);
+	}
+}
+
+bool DOS_Drive_Cache::OverlayName(const char* path, char* overlayName) {
+	size_t len = strlen(basePath);
+	if (!overlayPath[0] || strncmp(path,basePath,len)) return false;
+	strcpy(overlayName,overlayPath);
+	strcat(overlayName,path+len);
+	return true;
+}
+
 void DOS_Drive_Cache::SetLabel(const char* vname,bool cdrom,bool allowupdate) {
 /* allowupdate defaults to true. if mount sets a label then allowupdate is 
  * false and will this function return at once after the first call.
@@ -123,12 +403,8 @@ Bit16u DOS_Drive_Cache::GetFreeID(CFileInfo* dir) {
 }
 
 void DOS_Drive_Cache::SetBaseDir(const char* baseDir) {
-	Bit16u id;
 	strcpy(basePath,baseDir);
-	if (OpenDir(baseDir,id)) {
-		char* result = 0;
-		ReadDir(id,result);
-	};
+	// the base dir gets cached in on first use
 	// Get Volume Label
 #if defined (WIN32) || defined (OS2)
 	bool cdrom = false;
@@ -203,19 +479,17 @@ void DOS_Drive_Cache::AddEntry(const char* path, bool checkExists) {
 		strcpy(file,pos+1);	
 		// Check if file already exists, then don't add new entry...
 		if (checkExists) {
-			if (GetLongName(dir,file)>=0) return;
+			if (FindLongName(dir,file) || GetLongName(dir,file)) return;
 		}
 
-		CreateEntry(dir,file,false);
+		CFileInfo* info = CreateEntry(dir,file,false);
 
-		Bits index = GetLongName(dir,file);
-		if (index>=0) {
-			Bit32u i;
-			// Check if there are any open search dir that are affected by this...
-			if (dir) for (i=0; i<MAX_OPENDIRS; i++) {
-				if ((dirSearch[i]==dir) && ((Bit32u)index<=dirSearch[i]->nextEntry)) 
-					dirSearch[i]->nextEntry++;
-			}
+		Bit32u index = (Bit32u)(std::lower_bound(dir->fileList.begin(),dir->fileList.end(),info,SortByName)-dir->fileList.begin());
+		Bit32u i;
+		// Check if there are any open search dir that are affected by this...
+		for (i=0; i<MAX_OPENDIRS; i++) {
+			if ((dirSearch[i]==dir) && (index<=dirSearch[i]->nextEntry)) 
+				dirSearch[i]->nextEntry++;
 		}
 		//		LOG_DEBUG("DIR: Added Entry %s",path);
 	} else {
@@ -259,14 +533,11 @@ void DOS_Drive_Cache::CacheOut(const char* path, bool ignoreLastDir) {
 	}
 
 //	LOG_DEBUG("DIR: Caching out %s : dir %s",expand,dir->orgname);
-	// delete file objects...
 	for(Bit32u i=0; i<dir->fileList.size(); i++) {
 		if (dirSearch[srchNr]==dir->fileList[i]) dirSearch[srchNr] = 0;
-		delete dir->fileList[i]; dir->fileList[i] = 0;
 	}
-	// clear lists
-	dir->fileList.clear();
-	dir->longNameList.clear();
+	// delete file objects and clear lists
+	DropContents(dir);
 	save_dir = 0;
 }
 
@@ -280,82 +551,50 @@ bool DOS_Drive_Cache::GetShortName(const char* fullname, char* shortname) {
 	char expand[CROSS_LEN] = {0};
 	CFileInfo* curDir = FindDirInfo(fullname,expand);
 
-	std::vector<CFileInfo*>::size_type filelist_size = curDir->longNameList.size();
-	if (GCC_UNLIKELY(filelist_size<=0)) return false;
+	const char* pos = strrchr(fullname,CROSS_FILESPLIT);
+	CFileInfo* info = FindLongName(curDir,pos ? pos+1 : fullname);
+	if (!info) return false;
+	strcpy(shortname,info->shortname);
+	return true;
+}
 
-	Bits low		= 0;
-	Bits high		= (Bits)(filelist_size-1);
-	Bits mid, res;
+static INLINE Bitu HashName(const char* name) {
+	Bitu hash = 5381;
+	while (*name) hash = hash*33 + (Bit8u)*name++;
+	return hash;
+}
 
-	while (low<=high) {
-		mid = (low+high)/2;
-		res = strcmp(fullname,curDir->longNameList[mid]->orgname);
-		if (res>0)	low  = mid+1; else
-		if (res<0)	high = mid-1; 
-		else {
-			strcpy(shortname,curDir->longNameList[mid]->shortname);
-			return true;
-		};
+void DOS_Drive_Cache::AddToIndex(CFileInfo* dir, CFileInfo* info) {
+	// info has been added to fileList already
+	if (dir->fileList.size()>dir->shortHash.size()) {
+		Bitu size = dir->shortHash.empty() ? 16 : dir->shortHash.size()*2;
+		dir->shortHash.assign(size,0);
+		dir->longHash.assign(size,0);
+		for (Bitu i=0; i<dir->fileList.size(); i++) {
+			if (dir->fileList[i]!=info) AddToIndex(dir,dir->fileList[i]);
+		}
 	}
-	return false;
+	Bitu mask = dir->shortHash.size()-1;
+	CFileInfo* &shortSlot = dir->shortHash[HashName(info->shortname) & mask];
+	info->nextShort = shortSlot;
+	shortSlot = info;
+	CFileInfo* &longSlot = dir->longHash[HashName(info->orgname) & mask];
+	info->nextLong = longSlot;
+	longSlot = info;
 }
 
-int DOS_Drive_Cache::CompareShortname(const char* compareName, const char* shortName) {
-	char const* cpos = strchr(shortName,'~');
-	if (cpos) {
-/* the following code is replaced as it's not safe when char* is 64 bits */
-/*		Bits compareCount1	= (int)cpos - (int)shortName;
-		char* endPos		= strchr(cpos,'.');
-		Bitu numberSize		= endPos ? int(endPos)-int(cpos) : strlen(cpos);
-		
-		char* lpos			= strchr(compareName,'.');
-		Bits compareCount2	= lpos ? int(lpos)-int(compareName) : strlen(compareName);
-		if (compareCount2>8) compareCount2 = 8;
+DOS_Drive_Cache::CFileInfo* DOS_Drive_Cache::FindShortName(CFileInfo* dir, const char* shortname) {
+	if (dir->shortHash.empty()) return 0;
+	CFileInfo* info = dir->shortHash[HashName(shortname) & (dir->shortHash.size()-1)];
+	while (info && strcmp(shortname,info->shortname)) info = info->nextShort;
+	return info;
+}
 
-		compareCount2 -= numberSize;
-		if (compareCount2>compareCount1) compareCount1 = compareCount2;
-*/
-		size_t compareCount1 = strcspn(shortName,"~");
-		size_t numberSize    = strcspn(cpos,".");
-		size_t compareCount2 = strcspn(compareName,".");
-		if(compareCount2 > 8) compareCount2 = 8;
-		/* We want 
-		 * compareCount2 -= numberSize;
-		 * if (compareCount2>compareCount1) compareCount1 = compareCount2;
-		 * but to prevent negative numbers: 
-		 */
-		if(compareCount2 > compareCount1 + numberSize)
-			compareCount1 = compareCount2 - numberSize;
-		return strncmp(compareName,shortName,compareCount1);
-	}
-	return strcmp(compareName,shortName);
-}
-
-Bitu DOS_Drive_Cache::CreateShortNameID(CFileInfo* curDir, const char* name) {
-	std::vector<CFileInfo*>::size_type filelist_size = curDir->longNameList.size();
-	if (GCC_UNLIKELY(filelist_size<=0)) return 1;	// shortener IDs start with 1
-
-	Bitu foundNr	= 0;	
-	Bits low		= 0;
-	Bits high		= (Bits)(filelist_size-1);
-	Bits mid, res;
-
-	while (low<=high) {
-		mid = (low+high)/2;
-		res = CompareShortname(name,curDir->longNameList[mid]->shortname);
-		
-		if (res>0)	low  = mid+1; else
-		if (res<0)	high = mid-1; 
-		else {
-			// any more same x chars in next entries ?	
-			do {
-				foundNr = curDir->longNameList[mid]->shortNr;
-				mid++;
-			} while((Bitu)mid<curDir->longNameList.size() && (CompareShortname(name,curDir->longNameList[mid]->shortname)==0));
-			break;
-		};
-	}
-	return foundNr+1;
+DOS_Drive_Cache::CFileInfo* DOS_Drive_Cache::FindLongName(CFileInfo* dir, const char* longname) {
+	if (dir->longHash.empty()) return 0;
+	CFileInfo* info = dir->longHash[HashName(longname) & (dir->longHash.size()-1)];
+	while (info && strcmp(longname,info->orgname)) info = info->nextLong;
+	return info;
 }
 
 bool DOS_Drive_Cache::RemoveTrailingDot(char* shortname) {
@@ -370,28 +609,12 @@ bool DOS_Drive_Cache::RemoveTrailingDot(char* shortname) {
 	return false;
 }
 
-Bits DOS_Drive_Cache::GetLongName(CFileInfo* curDir, char* shortName) {
-	std::vector<CFileInfo*>::size_type filelist_size = curDir->fileList.size();
-	if (GCC_UNLIKELY(filelist_size<=0)) return -1;
-
+DOS_Drive_Cache::CFileInfo* DOS_Drive_Cache::GetLongName(CFileInfo* curDir, char* shortName) {
 	// Remove dot, if no extension...
 	RemoveTrailingDot(shortName);
-	// Search long name and return array number of element
-	Bits low	= 0;
-	Bits high	= (Bits)(filelist_size-1);
-	Bits mid,res;
-	while (low<=high) {
-		mid = (low+high)/2;
-		res = strcmp(shortName,curDir->fileList[mid]->shortname);
-		if (res>0)	low  = mid+1; else
-		if (res<0)	high = mid-1; else
-		{	// Found
-			strcpy(shortName,curDir->fileList[mid]->orgname);
-			return mid;
-		};
-	}
-	// not available
-	return -1;
+	CFileInfo* info = FindShortName(curDir,shortName);
+	if (info) strcpy(shortName,info->orgname);
+	return info;
 }
 
 bool DOS_Drive_Cache::RemoveSpaces(char* str) {
@@ -405,18 +628,10 @@ bool DOS_Drive_Cache::RemoveSpaces(char* str) {
 	return (curpos!=chkpos);
 }
 
-void DOS_Drive_Cache::CreateShortName(CFileInfo* curDir, CFileInfo* info) {
-	Bits	len			= 0;
-	bool	createShort = false;
-
-	char tmpNameBuffer[CROSS_LEN];
-
-	char* tmpName = tmpNameBuffer;
-
+bool DOS_Drive_Cache::ShortNameBase(char* &tmpName, Bits& len) {
 	// Remove Spaces
-	strcpy(tmpName,info->orgname);
 	upcase(tmpName);
-	createShort = RemoveSpaces(tmpName);
+	bool changed = RemoveSpaces(tmpName);
 
 	// Get Length of filename
 	char* pos = strchr(tmpName,'.');
@@ -424,7 +639,7 @@ void DOS_Drive_Cache::CreateShortName(CFileInfo* curDir, CFileInfo* info) {
 		// ignore preceding '.' if extension is longer than "3"
 		if (strlen(pos)>4) {
 			while (*tmpName=='.') tmpName++;
-			createShort = true;
+			changed = true;
 		}
 		pos = strchr(tmpName,'.');
 		if (pos)	len = (Bits)(pos - tmpName);
@@ -432,61 +647,57 @@ void DOS_Drive_Cache::CreateShortName(CFileInfo* curDir, CFileInfo* info) {
 	} else {
 		len = (Bits)strlen(tmpName);
 	}
+	return changed;
+}
+
+void DOS_Drive_Cache::CreateShortName(CFileInfo* curDir, CFileInfo* info) {
+	Bits	len			= 0;
+	bool	createShort = false;
+
+	char tmpNameBuffer[CROSS_LEN];
+
+	char* tmpName = tmpNameBuffer;
+
+	strcpy(tmpName,info->orgname);
+	createShort = ShortNameBase(tmpName,len);
+	char* pos = strchr(tmpName,'.');
 
 	// Should shortname version be created ?
 	createShort = createShort || (len>8);
 	if (!createShort) {
 		char buffer[CROSS_LEN];
 		strcpy(buffer,tmpName);
-		createShort = (GetLongName(curDir,buffer)>=0);
+		createShort = (GetLongName(curDir,buffer)!=0);
 	}
 
 	if (createShort) {
-		// Create number
-		char buffer[8];
-		info->shortNr = CreateShortNameID(curDir,tmpName);
-		sprintf(buffer,"%d",info->shortNr);
-		// Copy first letters
-		Bits tocopy = 0;
-		size_t buflen = strlen(buffer);
-		if (len+buflen+1>8)	tocopy = (Bits)(8 - buflen - 1);
-		else				tocopy = len;
-		safe_strncpy(info->shortname,tmpName,tocopy+1);
-		// Copy number
-		strcat(info->shortname,"~");
-		strcat(info->shortname,buffer);
-		// Add (and cut) Extension, if available
-		if (pos) {
-			// Step to last extension...
-			pos = strrchr(tmpName, '.');
-			// add extension
-			strncat(info->shortname,pos,4);
-			info->shortname[DOS_NAMELENGTH] = 0;
-		}
-
-		// keep list sorted for CreateShortNameID to work correctly
-		if (curDir->longNameList.size()>0) {
-			if (!(strcmp(info->shortname,curDir->longNameList.back()->shortname)<0)) {
-				// append at end of list
-				curDir->longNameList.push_back(info);
-			} else {
-				// look for position where to insert this element
-				bool found=false;
-				std::vector<CFileInfo*>::iterator it;
-				for (it=curDir->longNameList.begin(); it!=curDir->longNameList.end(); ++it) {
-					if (strcmp(info->shortname,(*it)->shortname)<0) {
-						found = true;
-						break;
-					}
-				}
-				// Put it in longname list...
-				if (found) curDir->longNameList.insert(it,info);
-				else curDir->longNameList.push_back(info);
+		// Step to last extension...
+		if (pos) pos = strrchr(tmpName, '.');
+		// Names sharing the first letters count on together, whatever the extension
+		Bitu& lastNr = curDir->shortNrs[std::string(tmpName,len<6 ? len : 6)];
+		do {
+			// Create number
+			char buffer[16];
+			info->shortNr = ++lastNr;
+			sprintf(buffer,"%d",info->shortNr);
+			// Copy first letters
+			Bits tocopy = 0;
+			size_t buflen = strlen(buffer);
+			if (len+buflen+1>8)	tocopy = (Bits)(8 - buflen - 1);
+			else				tocopy = len;
+			safe_strncpy(info->shortname,tmpName,tocopy+1);
+			// Copy number
+			strcat(info->shortname,"~");
+			strcat(info->shortname,buffer);
+			// Add (and cut) Extension, if available
+			if (pos) {
+				// add extension
+				strncat(info->shortname,pos,4);
+				info->shortname[DOS_NAMELENGTH] = 0;
 			}
-		} else {
-			// empty file list, append
-			curDir->longNameList.push_back(info);
-		}
+			RemoveTrailingDot(info->shortname);
+			// other prefixes can end up with the same name
+		} while (FindShortName(curDir,info->shortname));
 	} else {
 		strcpy(info->shortname,tmpName);
 	}
@@ -535,7 +746,7 @@ DOS_Drive_Cache::CFileInfo* DOS_Drive_Cache::FindDirInfo(const char* path, char*
 		else	 { strcpy(dir,start); };
  
 		// Path found
-		Bits nextDir = GetLongName(curDir,dir);
+		CFileInfo* nextDir = GetLongName(curDir,dir);
 		strcat(expandedPath,dir);
 
 		// Error check
@@ -544,8 +755,8 @@ DOS_Drive_Cache::CFileInfo* DOS_Drive_Cache::FindDirInfo(const char* path, char*
 		};
 */
 		// Follow Directory
-		if ((nextDir>=0) && curDir->fileList[nextDir]->isDir) {
-			curDir = curDir->fileList[nextDir];
+		if (nextDir && nextDir->isDir) {
+			curDir = nextDir;
 			strcpy (curDir->orgname,dir);
 			if (!IsCachedIn(curDir)) {
 				if (OpenDir(curDir,expandedPath,id)) {
@@ -594,6 +805,9 @@ bool DOS_Drive_Cache::OpenDir(CFileInfo* dir, const char* expand, Bit16u& id) {
 	if (dirSearch[id]) {
 		// open dir
 		dir_information* dirp = open_directory(expandcopy);
+		// directories created on an overlay only exist there
+		char overlaycopy[CROSS_LEN];
+		if (!dirp && OverlayName(expandcopy,overlaycopy)) dirp = open_directory(overlaycopy);
 		if (dirp) { 
 			// Reset it..
 			close_directory(dirp);
@@ -605,7 +819,7 @@ bool DOS_Drive_Cache::OpenDir(CFileInfo* dir, const char* expand, Bit16u& id) {
 	return false;
 }
 
-void DOS_Drive_Cache::CreateEntry(CFileInfo* dir, const char* name, bool is_directory) {
+DOS_Drive_Cache::CFileInfo* DOS_Drive_Cache::CreateEntry(CFileInfo* dir, const char* name, bool is_directory) {
 	CFileInfo* info = new CFileInfo;
 	strcpy(info->orgname, name);				
 	info->shortNr = 0;
@@ -614,30 +828,15 @@ void DOS_Drive_Cache::CreateEntry(CFileInfo* dir, const char* name, bool is_dire
 	// Check for long filenames...
 	CreateShortName(dir, info);		
 
-	bool found = false;
-
-	// keep list sorted (so GetLongName works correctly, used by CreateShortName in this routine)
-	if (dir->fileList.size()>0) {
-		if (!(strcmp(info->shortname,dir->fileList.back()->shortname)<0)) {
-			// append at end of list
-			dir->fileList.push_back(info);
-		} else {
-			// look for position where to insert this element
-			std::vector<CFileInfo*>::iterator it;
-			for (it=dir->fileList.begin(); it!=dir->fileList.end(); ++it) {
-				if (strcmp(info->shortname,(*it)->shortname)<0) {
-					found = true;
-					break;
-				}
-			}
-			// Put file in lists
-			if (found) dir->fileList.insert(it,info);
-			else dir->fileList.push_back(info);
-		}
-	} else {
-		// empty file list, append
+	// keep list sorted for the directory listing
+	if (dir->fileList.empty() || !(strcmp(info->shortname,dir->fileList.back()->shortname)<0)) {
+		// append at end of list
 		dir->fileList.push_back(info);
+	} else {
+		dir->fileList.insert(std::upper_bound(dir->fileList.begin(),dir->fileList.end(),info,SortByName),info);
 	}
+	AddToIndex(dir,info);
+	return info;
 }
 
 void DOS_Drive_Cache::CopyEntry(CFileInfo* dir, CFileInfo* from) {
@@ -656,24 +855,49 @@ bool DOS_Drive_Cache::ReadDir(Bit16u id, char* &result) {
 	if (id>MAX_OPENDIRS) return false;
 
 	if (!IsCachedIn(dirSearch[id])) {
+		char dir_name[CROSS_LEN];
+		bool is_directory;
+		bool found = false;
+		// watch before reading so no change gets lost
+		WatchDir(dirSearch[id],dirPath);
+		dirSearch[id]->stamp = GetDirStamp(dirPath);
+		// Overlay entries come first and hide the same and whited out names below
+		std::set<std::string> hidden;
+		char overlayDir[CROSS_LEN];
+		if (OverlayName(dirPath,overlayDir)) {
+			dir_information* dirp = open_directory(overlayDir);
+			if (dirp) {
+				found = true;
+				size_t wlen = strlen(OVERLAY_WHITEOUT);
+				bool more = read_directory_first(dirp, dir_name, is_directory);
+				while (more) {
+					if (strncmp(dir_name,OVERLAY_WHITEOUT,wlen)==0) hidden.insert(dir_name+wlen);
+					else {
+						hidden.insert(dir_name);
+						CreateEntry(dirSearch[id], dir_name, is_directory);
+					}
+					more = read_directory_next(dirp, dir_name, is_directory);
+				}
+				close_directory(dirp);
+			}
+		}
 		// Try to open directory
 		dir_information* dirp = open_directory(dirPath);
-		if (!dirp) {
+		if (dirp) {
+			found = true;
+			// Read complete directory
+			bool more = read_directory_first(dirp, dir_name, is_directory);
+			while (more) {
+				if (hidden.empty() || !hidden.count(dir_name)) CreateEntry(dirSearch[id], dir_name, is_directory);
+				more = read_directory_next(dirp, dir_name, is_directory);
+			}
+			// close dir
+			close_directory(dirp);
+		}
+		if (!found) {
 			free[id] = true;
 			return false;
 		}
-		// Read complete directory
-		char dir_name[CROSS_LEN];
-		bool is_directory;
-		if (read_directory_first(dirp, dir_name, is_directory)) {
-			CreateEntry(dirSearch[id], dir_name, is_directory);
-			while (read_directory_next(dirp, dir_name, is_directory)) {
-				CreateEntry(dirSearch[id], dir_name, is_directory);
-			}
-		}
-
-		// close dir
-		close_directory(dirp);
 
 		// Info
 /*		if (!dirp) {
@@ -28,6 +28,7 @@
 #include "support.h"
 #include "cross.h"
 #include "bios.h"
+#include "compressed_image.h"
 
 #define IMGTYPE_FLOPPY 0
 #define IMGTYPE_ISO    1
@@ -37,9 +38,6 @@
 #define FAT16		   1
 #define FAT32		   2
 
-Bit8u fatSectBuffer[1024];
-Bit32u curFatSect;
-
 class fatFile : public DOS_File {
 public:
 	fatFile(const char* name, Bit32u startCluster, Bit32u fileLen, fatDrive *useDrive);
@@ -62,7 +60,10 @@ public:
 
 	bool loadedSector;
 	fatDrive *myDrive;
+	fatExtentMap extents;
 private:
+	bool LoadSector(bool extend);
+	Bit32u DirectSectors(Bit32u len, bool extend, Bit32u & sect);
 	enum { NONE,READ,WRITE } last_action;
 	Bit16u info;
 };
@@ -87,21 +88,48 @@ static void convToDirFile(char *filename, char *filearray) {
 }
 
 fatFile::fatFile(const char* /*name*/, Bit32u startCluster, Bit32u fileLen, fatDrive *useDrive) {
-	Bit32u seekto = 0;
 	firstCluster = startCluster;
 	myDrive = useDrive;
 	filelength = fileLen;
 	open = true;
+	/* The first sector is loaded when it is accessed */
 	loadedSector = false;
+	currentSector = 0;
 	curSectOff = 0;
 	seekpos = 0;
 	memset(&sectorBuffer[0], 0, sizeof(sectorBuffer));
-	
-	if(filelength > 0) {
-		Seek(&seekto, DOS_SEEK_SET);
-		myDrive->loadedDisk->Read_AbsoluteSector(currentSector, sectorBuffer);
-		loadedSector = true;
+}
+
+/* Bring the sector holding seekpos into sectorBuffer, appending a cluster
+   to the chain first if the file has grown past its allocation */
+bool fatFile::LoadSector(bool extend) {
+	if (loadedSector) return true;
+	currentSector = myDrive->getAbsoluteSectFromBytePos(extents, firstCluster, seekpos);
+	if (currentSector == 0 && extend) {
+		myDrive->appendCluster(firstCluster);
+		currentSector = myDrive->getAbsoluteSectFromBytePos(extents, firstCluster, seekpos);
 	}
+	if (currentSector == 0) return false;
+	curSectOff = seekpos % myDrive->getSectorSize();
+	myDrive->loadedDisk->Read_AbsoluteSector(currentSector, sectorBuffer);
+	loadedSector = true;
+	return true;
+}
+
+/* Number of whole sectors at seekpos that can bypass sectorBuffer, returns
+   the first one in sect or 0 if the transfer has to go through the buffer */
+Bit32u fatFile::DirectSectors(Bit32u len, bool extend, Bit32u & sect) {
+	Bit32u sectSize = myDrive->getSectorSize();
+	if (loadedSector || (seekpos % sectSize) || len < sectSize) return 0;
+	Bit32u run;
+	sect = myDrive->getAbsoluteSectFromBytePos(extents, firstCluster, seekpos, &run);
+	if (sect == 0 && extend) {
+		myDrive->appendCluster(firstCluster);
+		sect = myDrive->getAbsoluteSectFromBytePos(extents, firstCluster, seekpos, &run);
+	}
+	if (sect == 0) return 0;
+	Bit32u count = len / sectSize;
+	return (count < run) ? count : run;
 }
 
 bool fatFile::Read(Bit8u * data, Bit16u *size) {
@@ -109,51 +137,40 @@ bool fatFile::Read(Bit8u * data, Bit16u *size) {
 		DOS_SetError(DOSERR_ACCESS_DENIED);
 		return false;
 	}
-	Bit16u sizedec, sizecount;
 	if(seekpos >= filelength) {
 		*size = 0;
 		return true;
 	}
 
-	if (!loadedSector) {
-		currentSector = myDrive->getAbsoluteSectFromBytePos(firstCluster, seekpos);
-		if(currentSector == 0) {
-			/* EOC reached before EOF */
-			*size = 0;
-			loadedSector = false;
-			return true;
-		}
-		curSectOff = 0;
-		myDrive->loadedDisk->Read_AbsoluteSector(currentSector, sectorBuffer);
-		loadedSector = true;
-	}
-
-	sizedec = *size;
-	sizecount = 0;
-	while(sizedec != 0) {
-		if(seekpos >= filelength) {
-			*size = sizecount;
-			return true; 
+	Bit32u sectSize = myDrive->getSectorSize();
+	Bit32u toread = *size;
+	if (toread > filelength - seekpos) toread = filelength - seekpos;
+	Bit32u sizecount = 0;
+	while (sizecount < toread) {
+		Bit32u left = toread - sizecount;
+		/* Whole sectors of a contiguous run go straight into the caller's buffer */
+		Bit32u sect;
+		Bit32u count = DirectSectors(left, false, sect);
+		if (count) {
+			myDrive->loadedDisk->Read_AbsoluteSectors(sect, count, &data[sizecount]);
+			sizecount += count * sectSize;
+			seekpos += count * sectSize;
+			continue;
 		}
-		data[sizecount++] = sectorBuffer[curSectOff++];
-		seekpos++;
-		if(curSectOff >= myDrive->getSectorSize()) {
-			currentSector = myDrive->getAbsoluteSectFromBytePos(firstCluster, seekpos);
-			if(currentSector == 0) {
-				/* EOC reached before EOF */
-				//LOG_MSG("EOC reached before EOF, seekpos %d, filelen %d", seekpos, filelength);
-				*size = sizecount;
-				loadedSector = false;
-				return true;
-			}
-			curSectOff = 0;
-			myDrive->loadedDisk->Read_AbsoluteSector(currentSector, sectorBuffer);
-			loadedSector = true;
-			//LOG_MSG("Reading absolute sector at %d for seekpos %d", currentSector, seekpos);
+		if (!LoadSector(false)) {
+			/* EOC reached before EOF */
+			//LOG_MSG("EOC reached before EOF, seekpos %d, filelen %d", seekpos, filelength);
+			break;
 		}
-		--sizedec;
+		Bit32u chunk = sectSize - curSectOff;
+		if (chunk > left) chunk = left;
+		memcpy(&data[sizecount], &sectorBuffer[curSectOff], chunk);
+		sizecount += chunk;
+		seekpos += chunk;
+		curSectOff += chunk;
+		if (curSectOff >= sectSize) loadedSector = false;
 	}
-	*size =sizecount;
+	*size = (Bit16u)sizecount;
 	return true;
 }
 
@@ -166,72 +183,53 @@ bool fatFile::Write(Bit8u * data, Bit16u *size) {
 	}
 
 	direntry tmpentry;
-	Bit16u sizedec, sizecount;
-	sizedec = *size;
-	sizecount = 0;
-
-	while(sizedec != 0) {
-		/* Increase filesize if necessary */
-		if(seekpos >= filelength) {
-			if(filelength == 0) {
-				firstCluster = myDrive->getFirstFreeClust();
-				myDrive->allocateCluster(firstCluster, 0);
-				currentSector = myDrive->getAbsoluteSectFromBytePos(firstCluster, seekpos);
-				myDrive->loadedDisk->Read_AbsoluteSector(currentSector, sectorBuffer);
-				loadedSector = true;
-			}
-			filelength = seekpos+1;
-			if (!loadedSector) {
-				currentSector = myDrive->getAbsoluteSectFromBytePos(firstCluster, seekpos);
-				if(currentSector == 0) {
-					/* EOC reached before EOF - try to increase file allocation */
-					myDrive->appendCluster(firstCluster);
-					/* Try getting sector again */
-					currentSector = myDrive->getAbsoluteSectFromBytePos(firstCluster, seekpos);
-					if(currentSector == 0) {
-						/* No can do. lets give up and go home.  We must be out of room */
-						goto finalizeWrite;
-					}
-				}
-				curSectOff = 0;
-				myDrive->loadedDisk->Read_AbsoluteSector(currentSector, sectorBuffer);
-
-				loadedSector = true;
-			}
+	Bit32u sectSize = myDrive->getSectorSize();
+	Bit32u towrite = *size;
+	Bit32u sizecount = 0;
+
+	if (towrite && filelength == 0) {
+		firstCluster = myDrive->getFirstFreeClust();
+		if (firstCluster == 0) {
+			/* Disk full */
+			*size = 0;
+			return true;
 		}
-		sectorBuffer[curSectOff++] = data[sizecount++];
-		seekpos++;
-		if(curSectOff >= myDrive->getSectorSize()) {
-			if(loadedSector) myDrive->loadedDisk->Write_AbsoluteSector(currentSector, sectorBuffer);
-
-			currentSector = myDrive->getAbsoluteSectFromBytePos(firstCluster, seekpos);
-			if(currentSector == 0) {
-				/* EOC reached before EOF - try to increase file allocation */
-				myDrive->appendCluster(firstCluster);
-				/* Try getting sector again */
-				currentSector = myDrive->getAbsoluteSectFromBytePos(firstCluster, seekpos);
-				if(currentSector == 0) {
-					/* No can do. lets give up and go home.  We must be out of room */
-					loadedSector = false;
-					goto finalizeWrite;
-				}
-			}
-			curSectOff = 0;
-			myDrive->loadedDisk->Read_AbsoluteSector(currentSector, sectorBuffer);
+		myDrive->allocateCluster(firstCluster, 0);
+		loadedSector = false;
+	}
 
-			loadedSector = true;
+	while (sizecount < towrite) {
+		Bit32u left = towrite - sizecount;
+		Bit32u sect;
+		Bit32u count = DirectSectors(left, true, sect);
+		if (count) {
+			myDrive->loadedDisk->Write_AbsoluteSectors(sect, count, &data[sizecount]);
+			sizecount += count * sectSize;
+			seekpos += count * sectSize;
+		} else {
+			if (!LoadSector(true)) {
+				/* No can do. lets give up and go home.  We must be out of room */
+				break;
+			}
+			Bit32u chunk = sectSize - curSectOff;
+			if (chunk > left) chunk = left;
+			memcpy(&sectorBuffer[curSectOff], &data[sizecount], chunk);
+			myDrive->loadedDisk->Write_AbsoluteSector(currentSector, sectorBuffer);
+			sizecount += chunk;
+			seekpos += chunk;
+			curSectOff += chunk;
+			if (curSectOff >= sectSize) loadedSector = false;
 		}
-		--sizedec;
+		/* Increase filesize if necessary */
+		if (seekpos > filelength) filelength = seekpos;
 	}
-	if(curSectOff>0 && loadedSector) myDrive->loadedDisk->Write_AbsoluteSector(currentSector, sectorBuffer);
 
-finalizeWrite:
 	myDrive->directoryBrowse(dirCluster, &tmpentry, dirIndex);
 	tmpentry.entrysize = filelength;
 	tmpentry.loFirstClust = (Bit16u)firstCluster;
 	myDrive->directoryChange(dirCluster, &tmpentry, dirIndex);
 
-	*size =sizecount;
+	*size = (Bit16u)sizecount;
 	return true;
 }
 
@@ -255,14 +253,8 @@ bool fatFile::Seek(Bit32u *pos, Bit32u type) {
 	if((Bit32u)seekto > filelength) seekto = (Bit32s)filelength;
 	if(seekto<0) seekto = 0;
 	seekpos = (Bit32u)seekto;
-	currentSector = myDrive->getAbsoluteSectFromBytePos(firstCluster, seekpos);
-	if (currentSector == 0) {
-		/* not within file size, thus no sector is available */
-		loadedSector = false;
-	} else {
-		curSectOff = seekpos % myDrive->getSectorSize();
-		myDrive->loadedDisk->Read_AbsoluteSector(currentSector, sectorBuffer);
-	}
+	/* The sector is loaded by the next partial read or write */
+	loadedSector = false;
 	*pos = seekpos;
 	return true;
 }
@@ -306,17 +298,14 @@ Bit32u fatDrive::getClusterValue(Bit32u clustNum) {
 	fatsectnum = bootbuffer.reservedsectors + (fatoffset / bootbuffer.bytespersector) + partSectOff;
 	fatentoff = fatoffset % bootbuffer.bytespersector;
 
-	if(curFatSect != fatsectnum) {
-		/* Load two sectors at once for FAT12 */
-		loadedDisk->Read_AbsoluteSector(fatsectnum, &fatSectBuffer[0]);
-		if (fattype==FAT12)
-			loadedDisk->Read_AbsoluteSector(fatsectnum+1, &fatSectBuffer[512]);
-		curFatSect = fatsectnum;
-	}
+	Bit8u * fatSect = getFatSector(fatsectnum);
 
 	switch(fattype) {
 		case FAT12:
-			clustValue = *((Bit16u *)&fatSectBuffer[fatentoff]);
+			/* FAT12 entries can straddle two sectors */
+			clustValue = fatSect[fatentoff];
+			if (fatentoff + 1 < bootbuffer.bytespersector) clustValue |= fatSect[fatentoff + 1] << 8;
+			else clustValue |= getFatSector(fatsectnum + 1)[0] << 8;
 			if(clustNum & 0x1) {
 				clustValue >>= 4;
 			} else {
@@ -324,10 +313,10 @@ Bit32u fatDrive::getClusterValue(Bit32u clustNum) {
 			}
 			break;
 		case FAT16:
-			clustValue = *((Bit16u *)&fatSectBuffer[fatentoff]);
+			clustValue = *((Bit16u *)&fatSect[fatentoff]);
 			break;
 		case FAT32:
-			clustValue = *((Bit32u *)&fatSectBuffer[fatentoff]);
+			clustValue = *((Bit32u *)&fatSect[fatentoff]);
 			break;
 	}
 
@@ -353,17 +342,19 @@ void fatDrive::setClusterValue(Bit32u clustNum, Bit32u clustValue) {
 	fatsectnum = bootbuffer.reservedsectors + (fatoffset / bootbuffer.bytespersector) + partSectOff;
 	fatentoff = fatoffset % bootbuffer.bytespersector;
 
-	if(curFatSect != fatsectnum) {
-		/* Load two sectors at once for FAT12 */
-		loadedDisk->Read_AbsoluteSector(fatsectnum, &fatSectBuffer[0]);
-		if (fattype==FAT12)
-			loadedDisk->Read_AbsoluteSector(fatsectnum+1, &fatSectBuffer[512]);
-		curFatSect = fatsectnum;
-	}
+	/* Let the extent maps of open files know whether their chains just grew
+	   or had links changed under them */
+	Bit32u oldValue = getClusterValue(clustNum);
+	if (clustValue == 0 || (oldValue != 0 && !isEndOfChain(oldValue))) chainGen++;
+	else appendGen++;
+
+	Bit8u * fatSect = getFatSector(fatsectnum);
+	Bit8u * nextSect = 0;
 
 	switch(fattype) {
 		case FAT12: {
-			Bit16u tmpValue = *((Bit16u *)&fatSectBuffer[fatentoff]);
+			if (fatentoff + 1 >= bootbuffer.bytespersector) nextSect = getFatSector(fatsectnum + 1);
+			Bit16u tmpValue = fatSect[fatentoff] | ((nextSect ? nextSect[0] : fatSect[fatentoff + 1]) << 8);
 			if(clustNum & 0x1) {
 				clustValue &= 0xfff;
 				clustValue <<= 4;
@@ -375,23 +366,41 @@ void fatDrive::setClusterValue(Bit32u clustNum, Bit32u clustValue) {
 				tmpValue &= 0xf000;
 				tmpValue |= (Bit16u)clustValue;
 			}
-			*((Bit16u *)&fatSectBuffer[fatentoff]) = tmpValue;
+			fatSect[fatentoff] = (Bit8u)tmpValue;
+			if (nextSect) nextSect[0] = (Bit8u)(tmpValue >> 8);
+			else fatSect[fatentoff + 1] = (Bit8u)(tmpValue >> 8);
 			break;
 			}
 		case FAT16:
-			*((Bit16u *)&fatSectBuffer[fatentoff]) = (Bit16u)clustValue;
+			*((Bit16u *)&fatSect[fatentoff]) = (Bit16u)clustValue;
 			break;
 		case FAT32:
-			*((Bit32u *)&fatSectBuffer[fatentoff]) = clustValue;
+			*((Bit32u *)&fatSect[fatentoff]) = clustValue;
 			break;
 	}
 	for(int fc=0;fc<bootbuffer.fatcopies;fc++) {
-		loadedDisk->Write_AbsoluteSector(fatsectnum + (fc * bootbuffer.sectorsperfat), &fatSectBuffer[0]);
-		if (fattype==FAT12) {
-			if (fatentoff>=511)
-				loadedDisk->Write_AbsoluteSector(fatsectnum+1+(fc * bootbuffer.sectorsperfat), &fatSectBuffer[512]);
-		}
+		loadedDisk->Write_AbsoluteSector(fatsectnum + (fc * bootbuffer.sectorsperfat), fatSect);
+		if (nextSect)
+			loadedDisk->Write_AbsoluteSector(fatsectnum+1+(fc * bootbuffer.sectorsperfat), nextSect);
+	}
+}
+
+Bit8u * fatDrive::getFatSector(Bit32u fatsectnum) {
+	Bitu slot = fatsectnum % FAT_CACHE_SECTORS;
+	if (fatCache[slot].sector != fatsectnum) {
+		loadedDisk->Read_AbsoluteSector(fatsectnum, fatCache[slot].data);
+		fatCache[slot].sector = fatsectnum;
 	}
+	return fatCache[slot].data;
+}
+
+bool fatDrive::isEndOfChain(Bit32u clustValue) {
+	switch(fattype) {
+		case FAT12: return clustValue >= 0xff8;
+		case FAT16: return clustValue >= 0xfff8;
+		case FAT32: return clustValue >= 0xfffffff8;
+	}
+	return false;
 }
 
 bool fatDrive::getEntryName(char *fullname, char *entname) {
@@ -506,6 +515,70 @@ Bit32u fatDrive::getAbsoluteSectFromBytePos(Bit32u startClustNum, Bit32u bytePos
 	return  getAbsoluteSectFromChain(startClustNum, bytePos / bootbuffer.bytespersector);
 }
 
+Bit32u fatDrive::getAbsoluteSectFromBytePos(fatExtentMap & map, Bit32u startClustNum, Bit32u bytePos, Bit32u * runSectors) {
+	Bit32u logicalSector = bytePos / bootbuffer.bytespersector;
+	Bit32u clustIndex = logicalSector / bootbuffer.sectorspercluster;
+	Bit32u sectClust = logicalSector % bootbuffer.sectorspercluster;
+
+	if (map.first != startClustNum || map.chainGen != chainGen) {
+		map.runs.clear();
+		map.first = startClustNum;
+		map.clusters = 0;
+		map.hint = 0;
+		map.chainGen = chainGen;
+		map.complete = false;
+	}
+	if (clustIndex >= map.clusters) {
+		if (map.complete) {
+			if (map.appendGen == appendGen) return 0;
+			/* Something was appended on this drive since, check the tail again */
+			map.complete = false;
+		}
+		if (map.runs.empty()) {
+			fatExtent run = { 0, startClustNum, 1 };
+			map.runs.push_back(run);
+			map.clusters = 1;
+		}
+		while (map.clusters <= clustIndex) {
+			fatExtent & last = map.runs.back();
+			Bit32u nextClust = getClusterValue(last.cluster + last.count - 1);
+			if (isEndOfChain(nextClust)) {
+				map.complete = true;
+				map.appendGen = appendGen;
+				return 0;
+			}
+			if (nextClust == last.cluster + last.count) {
+				last.count++;
+			} else {
+				fatExtent run = { map.clusters, nextClust, 1 };
+				map.runs.push_back(run);
+			}
+			map.clusters++;
+		}
+	}
+
+	/* Sequential access stays in the run of the previous lookup */
+	Bitu r = map.hint;
+	if (r >= map.runs.size() || clustIndex < map.runs[r].logical ||
+		clustIndex >= map.runs[r].logical + map.runs[r].count) {
+		Bitu lo = 0, hi = map.runs.size() - 1;
+		while (lo < hi) {
+			Bitu mid = (lo + hi + 1) / 2;
+			if (map.runs[mid].logical <= clustIndex) lo = mid;
+			else hi = mid - 1;
+		}
+		r = lo;
+		map.hint = (Bit32u)r;
+	}
+	const fatExtent & run = map.runs[r];
+	if (runSectors) {
+		/* Only the known part of the run, the rest is found on the next call */
+		Bit32u runEnd = run.logical + run.count;
+		*runSectors = (runEnd - clustIndex) * bootbuffer.sectorspercluster - sectClust;
+	}
+	return getClustFirstSect(run.cluster + (clustIndex - run.logical)) + sectClust;
+}
+
 Bit32u fatDrive::getAbsoluteSectFromChain(Bit32u startClustNum, Bit32u logicalSector) {
 	Bit32s skipClust = logicalSector / bootbuffer.sectorspercluster;
 	Bit32u sectClust = logicalSector % bootbuffer.sectorspercluster;
@@ -627,8 +700,11 @@ bool fatDrive::allocateCluster(Bit32u useCluster, Bit32u prevCluster) {
 	return true;
 }
 
-fatDrive::fatDrive(const char *sysFilename, Bit32u bytesector, Bit32u cylsector, Bit32u headscyl, Bit32u cylinders, Bit32u startSector) {
+fatDrive::fatDrive(const char *sysFilename, Bit32u bytesector, Bit32u cylsector, Bit32u headscyl, Bit32u cylinders, Bit32u startSector, const char * overlayFile) {
 	created_successfully = true;
+	for (Bitu i=0;i<FAT_CACHE_SECTORS;i++) fatCache[i].sector = 0xffffffff;
+	chainGen = 0;
+	appendGen = 0;
 	FILE *diskfile;
 	Bit32u filesize;
 	struct partTable mbrData;
@@ -639,17 +715,21 @@ fatDrive::fatDrive(const char *sysFilename, Bit32u bytesector, Bit32u cylsector,
 		imgDTA    = new DOS_DTA(imgDTAPtr);
 	}
 
-	diskfile = fopen(sysFilename, "rb+");
+	/* With an overlay the image itself is only read */
+	diskfile = fopen(sysFilename, overlayFile ? "rb" : "rb+");
 	if(!diskfile) {created_successfully = false;return;}
-	fseek(diskfile, 0L, SEEK_END);
-	filesize = (Bit32u)ftell(diskfile) / 1024L;
+	filesize = (Bit32u)(compressedImage::ImageSize(diskfile) / 1024L);
 
 	/* Load disk image */
-	loadedDisk = new imageDisk(diskfile, (Bit8u *)sysFilename, filesize, (filesize > 2880));
+	loadedDisk = new imageDisk(diskfile, (Bit8u *)sysFilename, filesize, (filesize > 2880), overlayFile != 0);
 	if(!loadedDisk) {
 		created_successfully = false;
 		return;
 	}
+	if(overlayFile && !loadedDisk->SetOverlay(overlayFile)) {
+		created_successfully = false;
+		return;
+	}
 
 	if(filesize > 2880) {
 		/* Set user specified harddrive parameters */
@@ -723,8 +803,6 @@ fatDrive::fatDrive(const char *sysFilename, Bit32u bytesector, Bit32u cylsector,
 	/* There is no cluster 0, this means we are in the root directory */
 	cwdDirCluster = 0;
 
-	memset(fatSectBuffer,0,1024);
-	curFatSect = 0xffffffff;
 }
 
 bool fatDrive::AllocationInfo(Bit16u *_bytes_sector, Bit8u *_sectors_cluster, Bit16u *_total_clusters, Bit16u *_free_clusters) {
@@ -764,6 +842,7 @@ bool fatDrive::isRemote(void) {	return false; }
 bool fatDrive::isRemovable(void) { return false; }
 
 Bits fatDrive::UnMount(void) {
+	loadedDisk->Flush();
 	delete this;
 	return 0;
 }
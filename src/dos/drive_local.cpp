@@ -23,6 +23,11 @@
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <vector>
+#include <algorithm>
+#include <set>
+#include <string>
 
 #include "dosbox.h"
 #include "dos_inc.h"
@@ -31,9 +36,18 @@
 #include "cross.h"
 #include "inout.h"
 
+#if !defined (O_BINARY)
+#define O_BINARY 0
+#endif
+
+/* Host descriptors shared by all open local files. The least recently
+   used file gives its descriptor back and reopens on its next access. */
+#define LOCALFILE_HOST_HANDLES 32
+
 class localFile : public DOS_File {
 public:
-	localFile(const char* name, FILE * handle);
+	localFile(const char* name, const char* hostname, int handle, bool writable);
+	~localFile();
 	bool Read(Bit8u * data,Bit16u * size);
 	bool Write(Bit8u * data,Bit16u * size);
 	bool Seek(Bit32u * pos,Bit32u type);
@@ -41,12 +55,46 @@ public:
 	Bit16u GetInformation(void);
 	bool UpdateDateTimeFromHost(void);   
 	void FlagReadOnlyMedium(void);
+	static int HostOpen(const char* hostname, int flags);
+	static void KeepOpen(const char* hostname, bool keep=true);
 private:
-	FILE * fhandle;
+	bool IsHostFile(const char* name, const struct stat* id);
+	bool OpenHandle(void);
+	void CloseHandle(void);
+	int fhandle;
+	char* hostname;
+	bool writable;
+	bool keep_open;
 	bool read_only_medium;
-	enum { NONE,READ,WRITE } last_action;
+	Bit32u filepos;
+	Bit32u last_use;
+	static std::vector<localFile*> files;
+	static Bitu handles;
+	static Bit32u use_counter;
 };
 
+std::vector<localFile*> localFile::files;
+Bitu localFile::handles = 0;
+Bit32u localFile::use_counter = 0;
+
+static INLINE Bits host_pread(int handle, void * data, Bitu size, Bit32u pos) {
+#if defined (WIN32)
+	if (lseek(handle,pos,SEEK_SET)!=(long)pos) return -1;
+	return read(handle,data,(unsigned int)size);
+#else
+	return pread(handle,data,size,pos);
+#endif
+}
+
+static INLINE Bits host_pwrite(int handle, void const * data, Bitu size, Bit32u pos) {
+#if defined (WIN32)
+	if (lseek(handle,pos,SEEK_SET)!=(long)pos) return -1;
+	return write(handle,data,(unsigned int)size);
+#else
+	return pwrite(handle,data,size,pos);
+#endif
+}
+
 
 bool localDrive::FileCreate(DOS_File * * file,char * name,Bit16u /*attributes*/) {
 //TODO Maybe care for attributes but not likely
@@ -65,26 +113,28 @@ bool localDrive::FileCreate(DOS_File * * file,char * name,Bit16u /*attributes*/)
 
 	}
 	
-	FILE * hand=fopen(temp_name,"wb+");
-	if (!hand){
+	int hand=localFile::HostOpen(temp_name,O_RDWR|O_CREAT|O_TRUNC);
+	if (hand<0){
 		LOG_MSG("Warning: file creation failed: %s",newname);
 		return false;
 	}
+	char hostname[CROSS_LEN];
+	strcpy(hostname,temp_name);
    
 	if(!existing_file) dirCache.AddEntry(newname, true);
 	/* Make the 16 bit device information */
-	*file=new localFile(name,hand);
+	*file=new localFile(name,hostname,hand,true);
 	(*file)->flags=OPEN_READWRITE;
 
 	return true;
 }
 
 bool localDrive::FileOpen(DOS_File * * file,char * name,Bit32u flags) {
-	const char* type;
+	int type;
 	switch (flags&0xf) {
-	case OPEN_READ:type="rb"; break;
-	case OPEN_WRITE:type="rb+"; break;
-	case OPEN_READWRITE:type="rb+"; break;
+	case OPEN_READ:type=O_RDONLY; break;
+	case OPEN_WRITE:type=O_RDWR; break;
+	case OPEN_READWRITE:type=O_RDWR; break;
 	default:
 		DOS_SetError(DOSERR_ACCESS_CODE_INVALID);
 		return false;
@@ -94,10 +144,11 @@ bool localDrive::FileOpen(DOS_File * * file,char * name,Bit32u flags) {
 	strcat(newname,name);
 	CROSS_FILENAME(newname);
 	dirCache.ExpandName(newname);
+	strcpy(newname,HostName(newname));
 
-	FILE * hand=fopen(newname,type);
+	int hand=localFile::HostOpen(newname,type);
 //	Bit32u err=errno;
-	if (!hand) { 
+	if (hand<0) { 
 		if((flags&0xf) != OPEN_READ) {
 			FILE * hmm=fopen(newname,"rb");
 			if (hmm) {
@@ -108,7 +159,7 @@ bool localDrive::FileOpen(DOS_File * * file,char * name,Bit32u flags) {
 		return false;
 	}
 
-	*file=new localFile(name,hand);
+	*file=new localFile(name,newname,hand,type==O_RDWR);
 	(*file)->flags=flags;  //for the inheritance flag and maybe check for others.
 //	(*file)->SetFileName(newname);
 	return true;
@@ -122,7 +173,7 @@ FILE * localDrive::GetSystemFilePtr(char const * const name, char const * const
 	CROSS_FILENAME(newname);
 	dirCache.ExpandName(newname);
 
-	return fopen(newname,type);
+	return fopen(HostName(newname),type);
 }
 
 bool localDrive::GetSystemFilename(char *sysName, char const * const dosName) {
@@ -131,6 +182,7 @@ bool localDrive::GetSystemFilename(char *sysName, char const * const dosName) {
 	strcat(sysName, dosName);
 	CROSS_FILENAME(sysName);
 	dirCache.ExpandName(sysName);
+	strcpy(sysName,HostName(sysName));
 	return true;
 }
 
@@ -140,13 +192,17 @@ bool localDrive::FileUnlink(char * name) {
 	strcat(newname,name);
 	CROSS_FILENAME(newname);
 	char *fullname = dirCache.GetExpandName(newname);
+	localFile::KeepOpen(fullname);
 	if (unlink(fullname)) {
 		//Unlink failed for some reason try finding it.
 		struct stat buffer;
 		if(stat(fullname,&buffer)) return false; // File not found.
 
 		FILE* file_writable = fopen(fullname,"rb+");
-		if(!file_writable) return false; //No acces ? ERROR MESSAGE NOT SET. FIXME ?
+		if(!file_writable) { //No acces ? ERROR MESSAGE NOT SET. FIXME ?
+			localFile::KeepOpen(fullname,false);
+			return false;
+		}
 		fclose(file_writable);
 
 		//File exists and can technically be deleted, nevertheless it failed.
@@ -163,11 +219,11 @@ bool localDrive::FileUnlink(char * name) {
 				found_file=true;
 			}
 		}
-		if(!found_file) return false;
-		if (!unlink(fullname)) {
+		if (found_file && !unlink(fullname)) {
 			dirCache.DeleteEntry(newname);
 			return true;
 		}
+		localFile::KeepOpen(fullname,false);
 		return false;
 	} else {
 		dirCache.DeleteEntry(newname);
@@ -255,7 +311,7 @@ again:
 	//and due to its design dir_ent might be lost.)
 	//Copying dir_ent first
 	strcpy(dir_entcopy,dir_ent);
-	if (stat(dirCache.GetExpandName(full_name),&stat_block)!=0) { 
+	if (stat(HostName(dirCache.GetExpandName(full_name)),&stat_block)!=0) { 
 		goto again;//No symlinks and such
 	}	
 
@@ -292,7 +348,7 @@ bool localDrive::GetFileAttr(char * name,Bit16u * attr) {
 	dirCache.ExpandName(newname);
 
 	struct stat status;
-	if (stat(newname,&status)==0) {
+	if (stat(HostName(newname),&status)==0) {
 		*attr=DOS_ATTR_ARCHIVE;
 		if(status.st_mode & S_IFDIR) *attr|=DOS_ATTR_DIRECTORY;
 		return true;
@@ -332,6 +388,7 @@ bool localDrive::TestDir(char * dir) {
 	strcat(newdir,dir);
 	CROSS_FILENAME(newdir);
 	dirCache.ExpandName(newdir);
+	strcpy(newdir,HostName(newdir));
 	// Skip directory test, if "\"
 	size_t len = strlen(newdir);
 	if (len && (newdir[len-1]!='\\')) {
@@ -355,8 +412,17 @@ bool localDrive::Rename(char * oldname,char * newname) {
 	strcpy(newnew,basedir);
 	strcat(newnew,newname);
 	CROSS_FILENAME(newnew);
-	int temp=rename(newold,dirCache.GetExpandName(newnew));
+	char fullnew[CROSS_LEN];
+	strcpy(fullnew,dirCache.GetExpandName(newnew));
+	// an existing target gets replaced
+	localFile::KeepOpen(newold);
+	localFile::KeepOpen(fullnew);
+	int temp=rename(newold,fullnew);
 	if (temp==0) dirCache.CacheOut(newnew);
+	else {
+		localFile::KeepOpen(newold,false);
+		localFile::KeepOpen(fullnew,false);
+	}
 	return (temp==0);
 
 }
@@ -377,7 +443,7 @@ bool localDrive::FileExists(const char* name) {
 	strcat(newname,name);
 	CROSS_FILENAME(newname);
 	dirCache.ExpandName(newname);
-	FILE* Temp=fopen(newname,"rb");
+	FILE* Temp=fopen(HostName(newname),"rb");
 	if(Temp==NULL) return false;
 	fclose(Temp);
 	return true;
@@ -390,7 +456,7 @@ bool localDrive::FileStat(const char* name, FileStat_Block * const stat_block) {
 	CROSS_FILENAME(newname);
 	dirCache.ExpandName(newname);
 	struct stat temp_stat;
-	if(stat(newname,&temp_stat)!=0) return false;
+	if(stat(HostName(newname),&temp_stat)!=0) return false;
 	/* Convert the stat to a FileStat */
 	struct tm *time;
 	if((time=localtime(&temp_stat.st_mtime))!=0) {
@@ -434,15 +500,74 @@ localDrive::localDrive(const char * startdir,Bit16u _bytes_sector,Bit8u _sectors
 }
 
 
-//TODO Maybe use fflush, but that seemed to fuck up in visual c
+int localFile::HostOpen(const char* hostname, int flags) {
+	if (handles>=LOCALFILE_HOST_HANDLES) {
+		localFile* oldest = 0;
+		for (Bitu i=0;i<files.size();i++) {
+			localFile* f = files[i];
+			if (f->fhandle<0 || f->keep_open) continue;
+			if (!oldest || (Bit32s)(f->last_use-oldest->last_use)<0) oldest = f;
+		}
+		if (oldest) oldest->CloseHandle();
+	}
+	int handle = ::open(hostname,flags|O_BINARY,0666);
+	if (handle>=0) handles++;
+	return handle;
+}
+
+/* The host file is about to be deleted, renamed or replaced, reopening it by
+   name won't work any more. keep=false gives the handles back if that failed */
+void localFile::KeepOpen(const char* hostname, bool keep) {
+	struct stat id;
+	bool have_id = (stat(hostname,&id)==0);
+	// nothing there, names of files kept before could match by accident
+	if (!keep && !have_id) return;
+	for (Bitu i=0;i<files.size();i++) {
+		localFile* f = files[i];
+		if (!f->IsHostFile(hostname,have_id ? &id : 0)) continue;
+		if (!keep) f->keep_open = false;
+		else if (f->OpenHandle()) f->keep_open = true;
+	}
+}
+
+/* Compare the files themselves, the same one can be reached by other names */
+bool localFile::IsHostFile(const char* name, const struct stat* id) {
+	if (!id || !id->st_ino) return strcmp(hostname,name)==0;
+	struct stat buf;
+	if (fhandle>=0 ? fstat(fhandle,&buf) : stat(hostname,&buf)) return false;
+	return buf.st_dev==id->st_dev && buf.st_ino==id->st_ino;
+}
+
+bool localFile::OpenHandle(void) {
+	last_use = ++use_counter;
+	if (fhandle>=0) return true;
+	if (!open) return false;
+	fhandle = HostOpen(hostname,writable ? O_RDWR : O_RDONLY);
+	if (fhandle<0) {
+		LOG(LOG_FILES,LOG_NORMAL)("Can't reopen %s",hostname);
+		DOS_SetError(DOSERR_ACCESS_DENIED);
+		return false;
+	}
+	return true;
+}
+
+void localFile::CloseHandle(void) {
+	if (fhandle<0) return;
+	close(fhandle);
+	fhandle = -1;
+	handles--;
+}
+
 bool localFile::Read(Bit8u * data,Bit16u * size) {
 	if ((this->flags & 0xf) == OPEN_WRITE) {	// check if file opened in write-only mode
 		DOS_SetError(DOSERR_ACCESS_DENIED);
 		return false;
 	}
-	if (last_action==WRITE) fseek(fhandle,ftell(fhandle),SEEK_SET);
-	last_action=READ;
-	*size=(Bit16u)fread(data,1,*size,fhandle);
+	if (!OpenHandle()) return false;
+	Bits done = *size ? host_pread(fhandle,data,*size,filepos) : 0;
+	if (done<0) done = 0;
+	*size=(Bit16u)done;
+	filepos+=(Bit32u)done;
 	/* Fake harddrive motion. Inspector Gadget with soundblaster compatible */
 	/* Same for Igor */
 	/* hardrive motion => unmask irq 2. Only do it when it's masked as unmasking is realitively heavy to emulate */
@@ -456,50 +581,48 @@ bool localFile::Write(Bit8u * data,Bit16u * size) {
 		DOS_SetError(DOSERR_ACCESS_DENIED);
 		return false;
 	}
-	if (last_action==READ) fseek(fhandle,ftell(fhandle),SEEK_SET);
-	last_action=WRITE;
+	if (!OpenHandle()) return false;
 	if(*size==0){  
-        return (!ftruncate(fileno(fhandle),ftell(fhandle)));
+        return (!ftruncate(fhandle,filepos));
     }
     else 
     {
-		*size=(Bit16u)fwrite(data,1,*size,fhandle);
+		Bits done = host_pwrite(fhandle,data,*size,filepos);
+		if (done<0) done = 0;
+		*size=(Bit16u)done;
+		filepos+=(Bit32u)done;
 		return true;
     }
 }
 
 bool localFile::Seek(Bit32u * pos,Bit32u type) {
-	int seektype;
+	Bit64s newpos = *reinterpret_cast<Bit32s*>(pos);
 	switch (type) {
-	case DOS_SEEK_SET:seektype=SEEK_SET;break;
-	case DOS_SEEK_CUR:seektype=SEEK_CUR;break;
-	case DOS_SEEK_END:seektype=SEEK_END;break;
+	case DOS_SEEK_SET:break;
+	case DOS_SEEK_CUR:newpos+=filepos;break;
+	case DOS_SEEK_END:
+		if (!OpenHandle()) return false;
+		newpos+=lseek(fhandle,0,SEEK_END);
+		break;
 	default:
 	//TODO Give some doserrorcode;
 		return false;//ERROR
 	}
-	int ret=fseek(fhandle,*reinterpret_cast<Bit32s*>(pos),seektype);
-	if (ret!=0) {
+	if (newpos<0 || newpos>0x7fffffff) {
 		// Out of file range, pretend everythings ok 
 		// and move file pointer top end of file... ?! (Black Thorne)
-		fseek(fhandle,0,SEEK_END);
+		if (!OpenHandle()) return false;
+		newpos=lseek(fhandle,0,SEEK_END);
 	};
-#if 0
-	fpos_t temppos;
-	fgetpos(fhandle,&temppos);
-	Bit32u * fake_pos=(Bit32u*)&temppos;
-	*pos=*fake_pos;
-#endif
-	*pos=(Bit32u)ftell(fhandle);
-	last_action=NONE;
+	filepos=(Bit32u)newpos;
+	*pos=filepos;
 	return true;
 }
 
 bool localFile::Close() {
 	// only close if one reference left
 	if (refCtr==1) {
-		if(fhandle) fclose(fhandle);
-		fhandle = 0;
+		CloseHandle();
 		open = false;
 	};
 	return true;
@@ -510,27 +633,39 @@ Bit16u localFile::GetInformation(void) {
 }
 	
 
-localFile::localFile(const char* _name, FILE * handle) {
+localFile::localFile(const char* _name, const char* _hostname, int handle, bool _writable) {
 	fhandle=handle;
+	hostname=new char[strlen(_hostname)+1];
+	strcpy(hostname,_hostname);
+	writable=_writable;
+	keep_open=false;
+	filepos=0;
+	last_use=++use_counter;
+	files.push_back(this);
 	open=true;
 	UpdateDateTimeFromHost();
 
 	attr=DOS_ATTR_ARCHIVE;
-	last_action=NONE;
 	read_only_medium=false;
 
 	name=0;
 	SetName(_name);
 }
 
+localFile::~localFile() {
+	CloseHandle();
+	files.erase(std::find(files.begin(),files.end(),this));
+	delete[] hostname;
+}
+
 void localFile::FlagReadOnlyMedium(void) {
 	read_only_medium = true;
 }
 
 bool localFile::UpdateDateTimeFromHost(void) {
-	if(!open) return false;
+	if(!open || !OpenHandle()) return false;
 	struct stat temp_stat;
-	fstat(fileno(fhandle),&temp_stat);
+	fstat(fhandle,&temp_stat);
 	struct tm * ltime;
 	if((ltime=localtime(&temp_stat.st_mtime))!=0) {
 		time=DOS_PackTime((Bit16u)ltime->tm_hour,(Bit16u)ltime->tm_min,(Bit16u)ltime->tm_sec);
@@ -610,7 +745,7 @@ bool cdromDrive::GetFileAttr(char * name,Bit16u * attr) {
 bool cdromDrive::FindFirst(char * _dir,DOS_DTA & dta,bool /*fcb_findfirst*/) {
 	// If media has changed, reInit drivecache.
 	if (MSCDEX_HasMediaChanged(subUnit)) {
-		dirCache.EmptyCache();
+		dirCache.ResetCache();
 		// Get Volume Label
 		char name[32];
 		if (MSCDEX_GetVolumeName(subUnit,name)) dirCache.SetLabel(name,true,true);
@@ -621,7 +756,7 @@ bool cdromDrive::FindFirst(char * _dir,DOS_DTA & dta,bool /*fcb_findfirst*/) {
 void cdromDrive::SetDir(const char* path) {
 	// If media has changed, reInit drivecache.
 	if (MSCDEX_HasMediaChanged(subUnit)) {
-		dirCache.EmptyCache();
+		dirCache.ResetCache();
 		// Get Volume Label
 		char name[32];
 		if (MSCDEX_GetVolumeName(subUnit,name)) dirCache.SetLabel(name,true,true);
@@ -644,3 +779,372 @@ Bits cdromDrive::UnMount(void) {
 	}
 	return 2;
 }
+
+
+// ********************************************
+// OVERLAY DRIVE
+// ********************************************
+
+overlayDrive::overlayDrive(const char * startdir,const char * overlaydir,Bit16u _bytes_sector,Bit8u _sectors_cluster,Bit16u _total_clusters,Bit16u _free_clusters,Bit8u _mediaid)
+		   :localDrive(startdir,_bytes_sector,_sectors_cluster,_total_clusters,_free_clusters,_mediaid) {
+	strcpy(this->overlaydir,overlaydir);
+	if (strlen(info)+strlen(overlaydir)+10 < sizeof(info)) {
+		strcat(info," overlay ");
+		strcat(info,overlaydir);
+	}
+	dirCache.SetOverlayDir(overlaydir);
+}
+
+bool overlayDrive::OverlayName(char const * expanded, char * ovlname) {
+	size_t len = strlen(basedir);
+	if (strncmp(expanded,basedir,len)) return false;
+	strcpy(ovlname,overlaydir);
+	strcat(ovlname,expanded+len);
+	return true;
+}
+
+bool overlayDrive::Exists(char const * name, bool * isdir) {
+	struct stat test;
+	if (stat(name,&test)) return false;
+	if (isdir) *isdir = (test.st_mode & S_IFDIR)!=0;
+	return true;
+}
+
+static void WhiteoutName(char const * ovlname, char * whname) {
+	char const * file = strrchr(ovlname,CROSS_FILESPLIT);
+	file = file ? file+1 : ovlname;
+	safe_strncpy(whname,ovlname,(file-ovlname)+1);
+	strcat(whname,OVERLAY_WHITEOUT);
+	strcat(whname,file);
+}
+
+/* A name is hidden when it or any directory above it is whited out, a removed
+   directory takes the markers of its own entries with it */
+bool overlayDrive::IsWhiteout(char const * ovlname) {
+	char work[CROSS_LEN];
+	char whname[CROSS_LEN];
+	size_t len = strlen(overlaydir);
+	safe_strncpy(work,ovlname,CROSS_LEN);
+	for (;;) {
+		WhiteoutName(work,whname);
+		if (Exists(whname)) return true;
+		char * pos = strrchr(work,CROSS_FILESPLIT);
+		if (!pos || (size_t)(pos-work) < len) return false;
+		*pos = 0;
+	}
+}
+
+void overlayDrive::SetWhiteout(char const * ovlname, bool set) {
+	char whname[CROSS_LEN];
+	WhiteoutName(ovlname,whname);
+	if (!set) {
+		unlink(whname);
+	} else if (MakeParents(whname)) {
+		FILE * marker = fopen(whname,"wb");
+		if (marker) fclose(marker);
+	}
+}
+
+bool overlayDrive::MakeParents(char const * ovlname) {
+	char work[CROSS_LEN];
+	strcpy(work,ovlname);
+	for (char * pos = work+strlen(overlaydir); *pos; pos++) {
+		if (*pos!=CROSS_FILESPLIT) continue;
+		*pos = 0;
+		if (!Exists(work)) {
+#if defined (WIN32)						/* MS Visual C++ */
+			if (mkdir(work)) return false;
+#else
+			if (mkdir(work,0700)) return false;
+#endif
+		}
+		*pos = CROSS_FILESPLIT;
+	}
+	return true;
+}
+
+static void ListDir(char const * dirname, std::vector<std::string> & names) {
+	char dir_name[CROSS_LEN];
+	bool is_directory;
+	dir_information* dirp = open_directory(dirname);
+	if (!dirp) return;
+	bool more = read_directory_first(dirp, dir_name, is_directory);
+	while (more) {
+		if (strcmp(dir_name,".") && strcmp(dir_name,"..")) names.push_back(dir_name);
+		more = read_directory_next(dirp, dir_name, is_directory);
+	}
+	close_directory(dirp);
+}
+
+/* Copy a file or directory tree of the base directory into the overlay,
+   keeping whatever the overlay already has or hides */
+bool overlayDrive::CopyUp(char const * from, char const * to) {
+	bool isdir;
+	if (!Exists(from,&isdir) || !MakeParents(to)) return false;
+	if (isdir) {
+#if defined (WIN32)						/* MS Visual C++ */
+		if (mkdir(to) && !Exists(to)) return false;
+#else
+		if (mkdir(to,0700) && !Exists(to)) return false;
+#endif
+		std::vector<std::string> names;
+		ListDir(from,names);
+		for (size_t i=0;i<names.size();i++) {
+			std::string subfrom = std::string(from) + CROSS_FILESPLIT + names[i];
+			std::string subto = std::string(to) + CROSS_FILESPLIT + names[i];
+			if (IsWhiteout(subto.c_str())) continue;
+			bool subdir = false;
+			Exists(subfrom.c_str(),&subdir);
+			if ((subdir || !Exists(subto.c_str())) && !CopyUp(subfrom.c_str(),subto.c_str())) return false;
+		}
+		return true;
+	}
+	FILE * src = fopen(from,"rb");
+	if (!src) return false;
+	FILE * dst = fopen(to,"wb");
+	if (!dst) {
+		fclose(src);
+		return false;
+	}
+	bool ok = true;
+	Bit8u buffer[16384];
+	size_t count;
+	while (ok && (count = fread(buffer,1,sizeof(buffer),src))>0) ok = (fwrite(buffer,1,count,dst)==count);
+	fclose(src);
+	fclose(dst);
+	if (!ok) unlink(to);
+	return ok;
+}
+
+/* Empty as DOS sees it: nothing in the overlay but whiteouts, and those hide
+   every entry of the base directory */
+bool overlayDrive::IsEmptyDir(char const * expanded, char const * ovlname) {
+	std::vector<std::string> names;
+	std::set<std::string> hidden;
+	size_t wlen = strlen(OVERLAY_WHITEOUT);
+	ListDir(ovlname,names);
+	for (size_t i=0;i<names.size();i++) {
+		if (names[i].compare(0,wlen,OVERLAY_WHITEOUT)) return false;
+		hidden.insert(names[i].substr(wlen));
+	}
+	names.clear();
+	if (!IsWhiteout(ovlname)) ListDir(expanded,names);
+	for (size_t i=0;i<names.size();i++) if (!hidden.count(names[i])) return false;
+	return true;
+}
+
+char const * overlayDrive::HostName(char const * expanded) {
+	static char work[CROSS_LEN];
+	if (!OverlayName(expanded,work)) return expanded;
+	if (Exists(work) || IsWhiteout(work)) return work;
+	return expanded;
+}
+
+bool overlayDrive::FileOpen(DOS_File * * file,char * name,Bit32u flags) {
+	if ((flags&0xf)==OPEN_WRITE || (flags&0xf)==OPEN_READWRITE) {
+		/* Files are copied into the overlay before they are changed */
+		char newname[CROSS_LEN];
+		char ovlname[CROSS_LEN];
+		strcpy(newname,basedir);
+		strcat(newname,name);
+		CROSS_FILENAME(newname);
+		dirCache.ExpandName(newname);
+		bool isdir = false;
+		if (OverlayName(newname,ovlname) && !Exists(ovlname) && !IsWhiteout(ovlname) &&
+			Exists(newname,&isdir) && !isdir) CopyUp(newname,ovlname);
+	}
+	return localDrive::FileOpen(file,name,flags);
+}
+
+FILE * overlayDrive::GetSystemFilePtr(char const * const name, char const * const type) {
+	char newname[CROSS_LEN];
+	char ovlname[CROSS_LEN];
+	strcpy(newname,basedir);
+	strcat(newname,name);
+	CROSS_FILENAME(newname);
+	dirCache.ExpandName(newname);
+	if (!strpbrk(type,"wa+") || !OverlayName(newname,ovlname)) return localDrive::GetSystemFilePtr(name,type);
+
+	if (!Exists(ovlname)) {
+		bool isdir = false;
+		if (IsWhiteout(ovlname)) {
+			/* Hidden files only come back when they are created anew */
+			if (!strpbrk(type,"wa") || !MakeParents(ovlname)) return 0;
+			FILE * created = fopen(ovlname,type);
+			if (created) SetWhiteout(ovlname,false);
+			return created;
+		}
+		if (Exists(newname,&isdir) && !isdir) CopyUp(newname,ovlname);
+		else MakeParents(ovlname);
+	}
+	return fopen(ovlname,type);
+}
+
+bool overlayDrive::FileCreate(DOS_File * * file,char * name,Bit16u /*attributes*/) {
+	char newname[CROSS_LEN];
+	char ovlname[CROSS_LEN];
+	strcpy(newname,basedir);
+	strcat(newname,name);
+	CROSS_FILENAME(newname);
+	char* temp_name = dirCache.GetExpandName(newname);
+	if (!OverlayName(temp_name,ovlname)) return false;
+	/* Test if file exists (so we need to truncate it). don't add to dirCache then */
+	bool existing_file = Exists(HostName(temp_name));
+
+	int hand = MakeParents(ovlname) ? localFile::HostOpen(ovlname,O_RDWR|O_CREAT|O_TRUNC) : -1;
+	if (hand<0){
+		LOG_MSG("Warning: file creation failed: %s",newname);
+		return false;
+	}
+	SetWhiteout(ovlname,false);
+
+	if(!existing_file) dirCache.AddEntry(newname, true);
+	*file=new localFile(name,ovlname,hand,true);
+	(*file)->flags=OPEN_READWRITE;
+	return true;
+}
+
+bool overlayDrive::FileUnlink(char * name) {
+	char newname[CROSS_LEN];
+	char fullname[CROSS_LEN];
+	char ovlname[CROSS_LEN];
+	strcpy(newname,basedir);
+	strcat(newname,name);
+	CROSS_FILENAME(newname);
+	strcpy(fullname,dirCache.GetExpandName(newname));
+	if (!OverlayName(fullname,ovlname)) return false;
+
+	bool isdir = false;
+	bool in_overlay = Exists(ovlname,&isdir);
+	bool in_base = !IsWhiteout(ovlname) && Exists(fullname,in_overlay ? 0 : &isdir);
+	if ((!in_overlay && !in_base) || isdir) return false;
+
+	localFile::KeepOpen(ovlname);
+	if (in_overlay && unlink(ovlname)) {
+		//Unlink failed, see if we have it open ourselves (see localDrive::FileUnlink)
+		bool found_file = false;
+		for(Bitu i = 0;i < DOS_FILES;i++){
+			if(Files[i] && Files[i]->IsName(name)) {
+				Bitu max = DOS_FILES;
+				while(Files[i]->IsOpen() && max--) {
+					Files[i]->Close();
+					if (Files[i]->RemoveRef()<=0) break;
+				}
+				found_file=true;
+			}
+		}
+		if(!found_file || unlink(ovlname)) {
+			localFile::KeepOpen(ovlname,false);
+			return false;
+		}
+	}
+	/* The original stays, hide it */
+	if (in_base) SetWhiteout(ovlname,true);
+	dirCache.DeleteEntry(newname);
+	return true;
+}
+
+bool overlayDrive::MakeDir(char * dir) {
+	char newdir[CROSS_LEN];
+	char fulldir[CROSS_LEN];
+	char ovlname[CROSS_LEN];
+	strcpy(newdir,basedir);
+	strcat(newdir,dir);
+	CROSS_FILENAME(newdir);
+	strcpy(fulldir,dirCache.GetExpandName(newdir));
+	if (!OverlayName(fulldir,ovlname) || Exists(HostName(fulldir))) return false;
+
+	bool hidden = IsWhiteout(ovlname);
+	if (!MakeParents(ovlname)) return false;
+#if defined (WIN32)						/* MS Visual C++ */
+	if (mkdir(ovlname)) return false;
+#else
+	if (mkdir(ovlname,0700)) return false;
+#endif
+	if (hidden) {
+		SetWhiteout(ovlname,false);
+		/* A removed directory of the base comes back empty */
+		std::vector<std::string> names;
+		ListDir(fulldir,names);
+		for (size_t i=0;i<names.size();i++) SetWhiteout((std::string(ovlname) + CROSS_FILESPLIT + names[i]).c_str(),true);
+	}
+	dirCache.CacheOut(newdir,true);
+	return true;
+}
+
+bool overlayDrive::RemoveDir(char * dir) {
+	char newdir[CROSS_LEN];
+	char fulldir[CROSS_LEN];
+	char ovlname[CROSS_LEN];
+	strcpy(newdir,basedir);
+	strcat(newdir,dir);
+	CROSS_FILENAME(newdir);
+	strcpy(fulldir,dirCache.GetExpandName(newdir));
+	if (!OverlayName(fulldir,ovlname)) return false;
+
+	bool isdir = false;
+	bool in_overlay = Exists(ovlname,&isdir) && isdir;
+	bool in_base = !IsWhiteout(ovlname) && Exists(fulldir,&isdir) && isdir;
+	if ((!in_overlay && !in_base) || !IsEmptyDir(fulldir,ovlname)) return false;
+
+	if (in_overlay) {
+		std::vector<std::string> names;
+		ListDir(ovlname,names);
+		for (size_t i=0;i<names.size();i++) unlink((std::string(ovlname) + CROSS_FILESPLIT + names[i]).c_str());
+		if (rmdir(ovlname)) return false;
+	}
+	if (in_base) SetWhiteout(ovlname,true);
+	dirCache.DeleteEntry(newdir,true);
+	return true;
+}
+
+bool overlayDrive::Rename(char * oldname,char * newname) {
+	char newold[CROSS_LEN];
+	char fullold[CROSS_LEN];
+	char ovlold[CROSS_LEN];
+	strcpy(newold,basedir);
+	strcat(newold,oldname);
+	CROSS_FILENAME(newold);
+	strcpy(fullold,dirCache.GetExpandName(newold));
+
+	char newnew[CROSS_LEN];
+	char fullnew[CROSS_LEN];
+	char ovlnew[CROSS_LEN];
+	strcpy(newnew,basedir);
+	strcat(newnew,newname);
+	CROSS_FILENAME(newnew);
+	strcpy(fullnew,dirCache.GetExpandName(newnew));
+	if (!OverlayName(fullold,ovlold) || !OverlayName(fullnew,ovlnew)) return false;
+
+	bool isdir = false;
+	if (!Exists(HostName(fullold),&isdir)) return false;
+	bool in_overlay = Exists(ovlold);
+	bool in_base = !IsWhiteout(ovlold) && Exists(fullold);
+	bool hidden = IsWhiteout(ovlnew);
+	if (!MakeParents(ovlnew)) return false;
+
+	/* Move what the overlay has, copy up what only the base has */
+	if (in_overlay) localFile::KeepOpen(ovlold);
+	localFile::KeepOpen(ovlnew);
+	if ((in_overlay && rename(ovlold,ovlnew)) ||
+		(in_base && (isdir || !in_overlay) && !CopyUp(fullold,ovlnew))) {
+		if (in_overlay) localFile::KeepOpen(ovlold,false);
+		localFile::KeepOpen(ovlnew,false);
+		return false;
+	}
+	if (hidden) {
+		SetWhiteout(ovlnew,false);
+		if (isdir) {
+			std::vector<std::string> names;
+			ListDir(fullnew,names);
+			for (size_t i=0;i<names.size();i++) {
+				std::string sub = std::string(ovlnew) + CROSS_FILESPLIT + names[i];
+				if (!Exists(sub.c_str())) SetWhiteout(sub.c_str(),true);
+			}
+		}
+	}
+	if (in_base) SetWhiteout(ovlold,true);
+	dirCache.CacheOut(newold,true);
+	dirCache.CacheOut(newnew);
+	return true;
+}
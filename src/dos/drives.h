@@ -71,8 +71,11 @@ public:
 	virtual bool isRemote(void);
 	virtual bool isRemovable(void);
 	virtual Bits UnMount(void);
-private:
+protected:
+	/* Host file to use for an expanded name, overlayDrive redirects these */
+	virtual char const * HostName(char const * expanded) { return expanded; }
 	char basedir[CROSS_LEN];
+private:
 	friend void DOS_Shell::CMD_SUBST(char* args); 	
 	struct {
 		char srch_dir[CROSS_LEN];
@@ -87,6 +90,31 @@ private:
 	} allocation;
 };
 
+/* A localDrive that leaves its directory untouched: created and changed files
+   live in the overlay directory, deleted ones are hidden by whiteout files */
+class overlayDrive : public localDrive {
+public:
+	overlayDrive(const char * startdir,const char * overlaydir,Bit16u _bytes_sector,Bit8u _sectors_cluster,Bit16u _total_clusters,Bit16u _free_clusters,Bit8u _mediaid);
+	virtual bool FileOpen(DOS_File * * file,char * name,Bit32u flags);
+	virtual FILE *GetSystemFilePtr(char const * const name, char const * const type);
+	virtual bool FileCreate(DOS_File * * file,char * name,Bit16u attributes);
+	virtual bool FileUnlink(char * name);
+	virtual bool RemoveDir(char * dir);
+	virtual bool MakeDir(char * dir);
+	virtual bool Rename(char * oldname,char * newname);
+protected:
+	virtual char const * HostName(char const * expanded);
+private:
+	bool OverlayName(char const * expanded, char * ovlname);
+	bool Exists(char const * name, bool * isdir = 0);
+	bool IsWhiteout(char const * ovlname);
+	void SetWhiteout(char const * ovlname, bool set);
+	bool MakeParents(char const * ovlname);
+	bool CopyUp(char const * from, char const * to);
+	bool IsEmptyDir(char const * expanded, char const * ovlname);
+	char overlaydir[CROSS_LEN];
+};
+
 #ifdef _MSC_VER
 #pragma pack (1)
 #endif
@@ -144,9 +172,28 @@ struct partTable {
 #pragma pack ()
 #endif
 
+#define FAT_CACHE_SECTORS	32
+
+/* Runs of contiguous clusters in a file's chain, built as the file is accessed */
+struct fatExtent {
+	Bit32u logical;		/* index of the first cluster of the run within the chain */
+	Bit32u cluster;
+	Bit32u count;
+};
+
+struct fatExtentMap {
+	fatExtentMap() : first(0), clusters(0), hint(0), chainGen(0), appendGen(0), complete(false) {}
+	std::vector<fatExtent> runs;
+	Bit32u first;
+	Bit32u clusters;
+	Bit32u hint;
+	Bit32u chainGen, appendGen;
+	bool complete;
+};
+
 class fatDrive : public DOS_Drive {
 public:
-	fatDrive(const char * sysFilename, Bit32u bytesector, Bit32u cylsector, Bit32u headscyl, Bit32u cylinders, Bit32u startSector);
+	fatDrive(const char * sysFilename, Bit32u bytesector, Bit32u cylsector, Bit32u headscyl, Bit32u cylinders, Bit32u startSector, const char * overlayFile = 0);
 	virtual bool FileOpen(DOS_File * * file,char * name,Bit32u flags);
 	virtual bool FileCreate(DOS_File * * file,char * name,Bit16u attributes);
 	virtual bool FileUnlink(char * name);
@@ -166,6 +213,7 @@ public:
 	virtual Bits UnMount(void);
 public:
 	Bit32u getAbsoluteSectFromBytePos(Bit32u startClustNum, Bit32u bytePos);
+	Bit32u getAbsoluteSectFromBytePos(fatExtentMap & map, Bit32u startClustNum, Bit32u bytePos, Bit32u * runSectors = 0);
 	Bit32u getSectorSize(void);
 	Bit32u getAbsoluteSectFromChain(Bit32u startClustNum, Bit32u logicalSector);
 	bool allocateCluster(Bit32u useCluster, Bit32u prevCluster);
@@ -177,6 +225,8 @@ public:
 	imageDisk *loadedDisk;
 	bool created_successfully;
 private:
+	Bit8u * getFatSector(Bit32u fatsectnum);
+	bool isEndOfChain(Bit32u clustValue);
 	Bit32u getClusterValue(Bit32u clustNum);
 	void setClusterValue(Bit32u clustNum, Bit32u clustValue);
 	Bit32u getClustFirstSect(Bit32u clustNum);
@@ -208,6 +258,15 @@ private:
 
 	Bit32u cwdDirCluster;
 	Bit32u dirPosition; /* Position in directory search */
+
+	/* Direct mapped cache of FAT sectors, writes go through to the image */
+	struct {
+		Bit32u sector;
+		Bit8u data[512];
+	} fatCache[FAT_CACHE_SECTORS];
+	/* Bumped when an existing link is changed or freed, and when a chain grows */
+	Bit32u chainGen;
+	Bit32u appendGen;
 };
 
 
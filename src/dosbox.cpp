@@ -373,9 +373,17 @@ void DOSBOX_Init(void) {
 	Pint->SetMinMax(0,10);
 	Pint->Set_help("How many frames DOSBox skips before drawing one.");
 
+	Pbool = secprop->Add_bool("autoframeskip",Property::Changeable::Always,false);
+	Pbool->Set_help("Raise frameskip while the host can't keep up with the emulated refresh rate and\n"
+	                "  lower it again once it does. frameskip is the starting value.");
+
 	Pbool = secprop->Add_bool("aspect",Property::Changeable::Always,false);
 	Pbool->Set_help("Do aspect correction, if your output method doesn't support scaling this can slow things down!.");
 
+	Pbool = secprop->Add_bool("frameatonce",Property::Changeable::Always,false);
+	Pbool->Set_help("Draw the whole EGA/VGA frame at display end instead of a few lines at a time.\n"
+		"  Faster, falls back automatically when a program changes the display mid-frame.");
+
 	Pmulti = secprop->Add_multi("scaler",Property::Changeable::Always," ");
 	Pmulti->SetValue("normal2x");
 	Pmulti->Set_help("Scaler used to enlarge/enhance low resolution modes.\n"
@@ -440,6 +448,10 @@ void DOSBOX_Init(void) {
 	Pint->Set_help("Setting it lower than 100 will be a percentage.");
 		
 #if C_FPU
+	Pbool = secprop->Add_bool("fpuhostround",Property::Changeable::OnlyAtStart,true);
+	Pbool->Set_help("Let the host's SSE2 unit do the integer conversions of FIST/FISTP and FRNDINT on x86-64 hosts.\n"
+	                "A check at startup compares it with the portable rounding code and falls back on any difference.\n"
+	                "Disable to always use the portable rounding code.");
 	secprop->AddInitFunction(&FPU_Init);
 #endif
 	secprop->AddInitFunction(&DMA_Init);//done
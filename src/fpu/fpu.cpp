@@ -27,6 +27,7 @@
 #include "mem.h"
 #include "fpu.h"
 #include "cpu.h"
+#include "setup.h"
 
 FPU_rec fpu;
 
@@ -624,7 +625,37 @@ void FPU_ESC7_Normal(Bitu rm) {
 }
 
 
-void FPU_Init(Section*) {
+#if !C_FPU_X86 && defined(FPU_HOST_ROUNDING)
+/* Compare the host conversions against the portable rounding in every mode */
+static bool FPU_CheckHostRounding(void) {
+	static const double values[] = {
+		0.0, 0.5, -0.5, 1.5, -1.5, 2.5, -2.5, 0.49999999999999994, -0.49999999999999994,
+		1.0000001, -1.0000001, 2.4999, -2.5001, 123456.5, -123456.5, 2147483647.5,
+		-2147483648.5, 4503599627370495.5, -4503599627370495.5, 9007199254740991.0
+	};
+	bool ok=true;
+	for (Bitu mode=0;mode<4;mode++) {
+		FPU_SetCW(0x37F | (mode << 10));
+		for (Bitu i=0;i<sizeof(values)/sizeof(values[0]);i++) {
+			fpu.host_round=true;
+			Bit64s host=FROUND_INT(values[i]);
+			fpu.host_round=false;
+			if (host!=FROUND_INT(values[i])) {
+				LOG_MSG("FPU:Host rounding of %g differs in mode %d, using portable rounding",values[i],(int)mode);
+				ok=false;
+			}
+		}
+	}
+	return ok;
+}
+#endif
+
+void FPU_Init(Section* sec) {
+	fpu.host_round=false;
+#if !C_FPU_X86 && defined(FPU_HOST_ROUNDING)
+	Section_prop * section=static_cast<Section_prop *>(sec);
+	if (section->Get_bool("fpuhostround")) fpu.host_round=FPU_CheckHostRounding();
+#endif
 	FPU_FINIT();
 }
 
@@ -18,6 +18,15 @@
 
 /* $Id: fpu_instructions.h,v 1.33 2009-05-27 09:15:41 qbix79 Exp $ */
 
+// on x86-64 hosts the integer conversions can use the sse2 unit directly,
+// selected at runtime by fpu.host_round (the fpuhostround setting)
+#if defined(__x86_64__) || defined(_M_X64)
+#define FPU_HOST_ROUNDING
+#endif
+
+#if defined(FPU_HOST_ROUNDING)
+#include <emmintrin.h>
+#endif
 
 static void FPU_FINIT(void) {
 	FPU_SetCW(0x37F);
@@ -86,6 +95,19 @@ static double FROUND(double in){
 	}
 }
 
+// round to an integer according to the control word. cvtsd2si rounds with the
+// mode in the host mxcsr, which uses the same encoding as the x87 control word,
+// so it is only used when that matches the guest mode
+static INLINE Bit64s FROUND_INT(double in) {
+#if defined(FPU_HOST_ROUNDING)
+	if (fpu.host_round) {
+		if (fpu.round==ROUND_Chop) return _mm_cvttsd_si64(_mm_set_sd(in));
+		if (((_mm_getcsr() >> 13) & 3)==(unsigned int)fpu.round) return _mm_cvtsd_si64(_mm_set_sd(in));
+	}
+#endif
+	return static_cast<Bit64s>(FROUND(in));
+}
+
 #define BIAS80 16383
 #define BIAS64 1023
 
@@ -226,16 +248,16 @@ static void FPU_FST_F80(PhysPt addr) {
 }
 
 static void FPU_FST_I16(PhysPt addr) {
-	mem_writew(addr,static_cast<Bit16s>(FROUND(fpu.regs[TOP].d)));
+	mem_writew(addr,static_cast<Bit16s>(FROUND_INT(fpu.regs[TOP].d)));
 }
 
 static void FPU_FST_I32(PhysPt addr) {
-	mem_writed(addr,static_cast<Bit32s>(FROUND(fpu.regs[TOP].d)));
+	mem_writed(addr,static_cast<Bit32s>(FROUND_INT(fpu.regs[TOP].d)));
 }
 
 static void FPU_FST_I64(PhysPt addr) {
 	FPU_Reg blah;
-	blah.ll = static_cast<Bit64s>(FROUND(fpu.regs[TOP].d));
+	blah.ll = FROUND_INT(fpu.regs[TOP].d);
 	mem_writed(addr,blah.l.lower);
 	mem_writed(addr+4,blah.l.upper);
 }
@@ -381,7 +403,7 @@ static void FPU_FUCOM(Bitu st, Bitu other){
 }
 
 static void FPU_FRNDINT(void){
-	Bit64s temp= static_cast<Bit64s>(FROUND(fpu.regs[TOP].d));
+	Bit64s temp= FROUND_INT(fpu.regs[TOP].d);
 	fpu.regs[TOP].d=static_cast<double>(temp);
 }
 
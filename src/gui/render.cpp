@@ -33,6 +33,7 @@
 #include "support.h"
 
 #include "render_scalers.h"
+#include "timer.h"
 
 Render_t render;
 ScalerLineHandler_t RENDER_DrawLine;
@@ -42,11 +43,13 @@ static void RENDER_CallBack( GFX_CallBackFunctions_t function );
 static void Check_Palette(void) {
 	/* Clean up any previous changed palette data */
 	if (render.pal.changed) {
-		memset(render.pal.modified, 0, sizeof(render.pal.modified));
+		memset(&render.pal.modified[render.pal.modFirst], 0, render.pal.modLast-render.pal.modFirst+1);
 		render.pal.changed = false;
 	}
 	if (render.pal.first>render.pal.last) 
 		return;
+	render.pal.modFirst = render.pal.first;
+	render.pal.modLast = render.pal.last;
 	Bitu i;
 	switch (render.scale.outMode) {
 	case scalerMode8:
@@ -86,12 +89,16 @@ static void Check_Palette(void) {
 	render.pal.last=0;
 }
 
-void RENDER_SetPal(Bit8u entry,Bit8u red,Bit8u green,Bit8u blue) {
+bool RENDER_SetPal(Bit8u entry,Bit8u red,Bit8u green,Bit8u blue) {
+	/* Rewriting the same colour doesn't need to widen the update range */
+	if (render.pal.rgb[entry].red==red && render.pal.rgb[entry].green==green &&
+		render.pal.rgb[entry].blue==blue) return false;
 	render.pal.rgb[entry].red=red;
 	render.pal.rgb[entry].green=green;
 	render.pal.rgb[entry].blue=blue;
 	if (render.pal.first>entry) render.pal.first=entry;
 	if (render.pal.last<entry) render.pal.last=entry;
+	return true;
 }
 
 static void RENDER_EmptyLineHandler(const void * src) {
@@ -104,6 +111,9 @@ static void RENDER_StartLineHandler(const void * s) {
 		for (Bits x=render.src.start;x>0;) {
 			if (GCC_UNLIKELY(src[0] != cache[0])) {
 				if (!GFX_StartUpdate( render.scale.outWrite, render.scale.outPitch )) {
+					/* The rest of the frame is lost, redraw all of the next one
+					   so lines vga skips as unchanged still get drawn */
+					render.scale.clearCache = true;
 					RENDER_DrawLine = RENDER_EmptyLineHandler;
 					return;
 				}
@@ -145,7 +155,62 @@ static void RENDER_ClearCacheHandler(const void * src) {
 	render.scale.lineHandler( src );
 }
 
+extern void GFX_SetTitle(Bit32s cycles, Bits frameskip,bool paused);
+
+/* Frame times as a multiple of the guest refresh period */
+static const float PacingLimits[RENDER_PACING_BUCKETS-1] = { 1.05f, 1.25f, 1.5f, 2.0f, 3.0f };
+
+static void RENDER_FramePacing(void) {
+	if (!render.frameskip.autoAdjust)
+		return;
+	Bit32u ticks = GetTicks();
+	Bit32u elapsed = ticks - render.frameskip.lastTicks;
+	render.frameskip.lastTicks = ticks;
+	/* Pauses and mode changes aren't frames, start a new window */
+	if (elapsed > 1000 || render.src.fps <= 0) {
+		render.frameskip.frames = 0;
+		render.frameskip.windowTicks = ticks;
+		render.frameskip.drawMicros = 0;
+		memset(render.frameskip.histogram, 0, sizeof(render.frameskip.histogram));
+		return;
+	}
+	float period = 1000.0f / render.src.fps;
+	Bitu bucket = 0;
+	while (bucket < RENDER_PACING_BUCKETS-1 && elapsed > period * PacingLimits[bucket]) bucket++;
+	render.frameskip.histogram[bucket]++;
+	if (++render.frameskip.frames < (Bitu)render.src.fps)
+		return;
+
+	/* Skip more as soon as we fall behind the guest, but only draw more
+	   again after a few seconds of keeping up to avoid flapping */
+	Bit32u host = ticks - render.frameskip.windowTicks;
+	Bit32u guest = (Bit32u)(render.frameskip.frames * period);
+	Bitu skip = render.frameskip.max;
+	if (host * 100 > guest * 105) {
+		render.frameskip.stable = 0;
+		if (skip < 10) skip++;
+	} else if (host * 100 <= guest * 102) {
+		if (++render.frameskip.stable >= 4) {
+			render.frameskip.stable = 0;
+			if (skip > 0) skip--;
+		}
+	} else render.frameskip.stable = 0;
+	if (skip != render.frameskip.max) {
+		LOG_MSG("RENDER:%d frames in %d ms (guest %d ms), drawing %d us, frame times %d %d %d %d %d %d, frameskip %d",
+			(int)render.frameskip.frames, (int)host, (int)guest, (int)render.frameskip.drawMicros,
+			(int)render.frameskip.histogram[0], (int)render.frameskip.histogram[1], (int)render.frameskip.histogram[2],
+			(int)render.frameskip.histogram[3], (int)render.frameskip.histogram[4], (int)render.frameskip.histogram[5], (int)skip);
+		render.frameskip.max = skip;
+		GFX_SetTitle(-1,render.frameskip.max,false);
+	}
+	render.frameskip.frames = 0;
+	render.frameskip.windowTicks = ticks;
+	render.frameskip.drawMicros = 0;
+	memset(render.frameskip.histogram, 0, sizeof(render.frameskip.histogram));
+}
+
 bool RENDER_StartUpdate(void) {
+	RENDER_FramePacing();
 	if (GCC_UNLIKELY(render.updating))
 		return false;
 	if (GCC_UNLIKELY(!render.active))
@@ -169,6 +234,7 @@ bool RENDER_StartUpdate(void) {
 	if (GCC_UNLIKELY( render.scale.clearCache) ) {
 //		LOG_MSG("Clearing cache");
 		//Will always have to update the screen with this one anyway, so let's update already
+		//clearCache stays set when the update fails
 		if (GCC_UNLIKELY(!GFX_StartUpdate( render.scale.outWrite, render.scale.outPitch )))
 			return false;
 		render.fullFrame = true;
@@ -177,8 +243,12 @@ bool RENDER_StartUpdate(void) {
 	} else {
 		if (render.pal.changed) {
 			/* Assume pal changes always do a full screen update anyway */
-			if (GCC_UNLIKELY(!GFX_StartUpdate( render.scale.outWrite, render.scale.outPitch )))
+			if (GCC_UNLIKELY(!GFX_StartUpdate( render.scale.outWrite, render.scale.outPitch ))) {
+				/* The next Check_Palette forgets which entries changed, so
+				   redraw everything once the output can be updated again */
+				render.scale.clearCache = true;
 				return false;
+			}
 			RENDER_DrawLine = render.scale.linePalHandler;
 			render.fullFrame = true;
 		} else {
@@ -222,6 +292,7 @@ extern Bitu PIC_Ticks;
 void RENDER_EndUpdate( bool abort ) {
 	if (GCC_UNLIKELY(!render.updating))
 		return;
+	Bit64u drawStart = render.frameskip.autoAdjust ? Cross::GetMicroTicks() : 0;
 	RENDER_DrawLine = RENDER_EmptyLineHandler;
 	if (GCC_UNLIKELY(CaptureState & (CAPTURE_IMAGE|CAPTURE_VIDEO))) {
 		Bitu pitch, flags;
@@ -241,9 +312,8 @@ void RENDER_EndUpdate( bool abort ) {
 		static int every = 0;
 		if( !render.scale.outWrite )
 		{
-			if( ++every == 8 )
+			if( ++every >= 8 && GFX_StartUpdate( render.scale.outWrite, render.scale.outPitch ) )
 			{
-				GFX_StartUpdate( render.scale.outWrite, render.scale.outPitch );
 				goto FORCE_UPDATE;
 			}
 		}
@@ -280,6 +350,7 @@ void RENDER_EndUpdate( bool abort ) {
 	}
 	#endif
 	render.frameskip.index = (render.frameskip.index + 1) & (RENDER_SKIP_CACHE - 1);
+	if (drawStart) render.frameskip.drawMicros += Cross::GetMicroTicks() - drawStart;
 	render.updating=false;
 }
 
@@ -538,6 +609,8 @@ forcenormal:
 	render.pal.first= 0;
 	render.pal.last = 255;
 	render.pal.changed = false;
+	render.pal.modFirst = 0;
+	render.pal.modLast = 255;
 	memset(render.pal.modified, 0, sizeof(render.pal.modified));
 	//Finish this frame using a copy only handler
 	RENDER_DrawLine = RENDER_FinishLineHandler;
@@ -583,7 +656,6 @@ void RENDER_SetSize(Bitu width,Bitu height,Bitu bpp,float fps,double ratio,bool
 	RENDER_Reset( );
 }
 
-extern void GFX_SetTitle(Bit32s cycles, Bits frameskip,bool paused);
 static void IncreaseFrameSkip(bool pressed) {
 	if (!pressed)
 		return;
@@ -626,6 +698,9 @@ void RENDER_Init(Section * sec) {
 	render.pal.last=0;
 	render.aspect=section->Get_bool("aspect");
 	render.frameskip.max=section->Get_int("frameskip");
+	render.frameskip.autoAdjust=section->Get_bool("autoframeskip");
+	render.frameskip.stable=0;
+	render.frameAtOnce=section->Get_bool("frameatonce");
 	render.frameskip.count=0;
 	std::string cline;
 	std::string scaler;
@@ -50,6 +50,7 @@
 #include "cpu.h"
 #include "cross.h"
 #include "control.h"
+#include "compressed_image.h"
 
 #define MAPPERFILE "mapper-" VERSION ".map"
 //#define DISABLE_JOYSTICK
@@ -213,6 +214,18 @@ struct SDL_Block {
 		Bitu sensitivity;
 	} mouse;
 	SDL_Rect updateRects[1024];
+	struct {
+		SDL_Thread * thread;
+		SDL_sem * start;
+		SDL_sem * idle;			//Held while a frame is presented
+		bool held;				//Main thread owns idle
+		volatile bool quit;
+		Bitu count;
+		Bit32u queued;
+		Bit64u latency_total;
+		Bit32u latency_max;
+		Bitu frames;
+	} present;
 	Bitu num_joysticks;
 #if defined (WIN32)
 	bool using_windib;
@@ -228,6 +241,40 @@ struct SDL_Block {
 
 static SDL_Block sdl;
 
+static INLINE bool GFX_PresentAsync(void) {
+	return sdl.present.thread && sdl.desktop.type==SCREEN_SURFACE && !SDL_MUSTLOCK(sdl.surface);
+}
+
+/* Wait for the present thread to go idle before touching the video driver */
+void GFX_SyncPresent(void) {
+	if (!sdl.present.thread || sdl.present.held) return;
+	SDL_SemWait(sdl.present.idle);
+	SDL_SemPost(sdl.present.idle);
+}
+
+/* True when frames go out on the present thread and may still be read after GFX_EndUpdate */
+bool GFX_PresentQueued(void) {
+	return GFX_PresentAsync();
+}
+
+static int GFX_PresentThread(void * /*data*/) {
+	for (;;) {
+		SDL_SemWait(sdl.present.start);
+		if (sdl.present.quit) break;
+		if (sdl.present.count)
+			SDL_UpdateRects( sdl.surface, sdl.present.count, sdl.updateRects );
+#ifdef WASTELAND
+		WastelandEXT::Update( sdl.surface );
+#endif
+		Bit32u latency = SDL_GetTicks() - sdl.present.queued;
+		sdl.present.latency_total += latency;
+		if (latency > sdl.present.latency_max) sdl.present.latency_max = latency;
+		sdl.present.frames++;
+		SDL_SemPost(sdl.present.idle);
+	}
+	return 0;
+}
+
 extern const char* RunningProgram;
 extern bool CPU_CycleAutoAdjust;
 //Globals for keyboard initialisation
@@ -239,6 +286,7 @@ void GFX_SetTitle(Bit32s cycles,Bits frameskip,bool paused){
 	static Bits internal_frameskip=0;
 	if(cycles != -1) internal_cycles = cycles;
 	if(frameskip != -1) internal_frameskip = frameskip;
+	GFX_SyncPresent();
 #ifdef WASTELAND
 	SDL_WM_SetCaption("Wasteland",VERSION);
 #else
@@ -416,6 +464,7 @@ static SDL_Surface * GFX_SetupSurfaceScaled(Bit32u sdl_flags, Bit32u bpp) {
 Bitu GFX_SetSize(Bitu width,Bitu height,Bitu flags,double scalex,double scaley,GFX_CallBack_t callback) {
 	if (sdl.updating)
 		GFX_EndUpdate( 0 );
+	GFX_SyncPresent();
 
 	sdl.draw.width=width;
 	sdl.draw.height=height;
@@ -677,6 +726,7 @@ dosurface:
 }
 
 void GFX_CaptureMouse(void) {
+	GFX_SyncPresent();
 	sdl.mouse.locked=!sdl.mouse.locked;
 	if (sdl.mouse.locked) {
 		SDL_WM_GrabInput(SDL_GRAB_ON);
@@ -730,9 +780,23 @@ bool GFX_StartUpdate(Bit8u * & pixels,Bitu & pitch) {
 		return false;
 	switch (sdl.desktop.type) {
 	case SCREEN_SURFACE:
+		if (GFX_PresentAsync()) {
+			/* Drop this frame while the previous one is still being presented */
+			if (SDL_SemTryWait(sdl.present.idle))
+				return false;
+			sdl.present.held=true;
+#ifdef WASTELAND
+			WastelandEXT::StartUpdate();
+#endif
+		}
 		if (sdl.blit.surface) {
-			if (SDL_MUSTLOCK(sdl.blit.surface) && SDL_LockSurface(sdl.blit.surface))
+			if (SDL_MUSTLOCK(sdl.blit.surface) && SDL_LockSurface(sdl.blit.surface)) {
+				if (sdl.present.held) {
+					sdl.present.held=false;
+					SDL_SemPost(sdl.present.idle);
+				}
 				return false;
+			}
 			pixels=(Bit8u *)sdl.blit.surface->pixels;
 			pitch=sdl.blit.surface->pitch;
 		} else {
@@ -818,6 +882,13 @@ void GFX_EndUpdate( const Bit16u *changedLines ) {
 				}
 				index++;
 			}
+			if (sdl.present.held) {
+				sdl.present.held=false;
+				sdl.present.count=rectCount;
+				sdl.present.queued=SDL_GetTicks();
+				SDL_SemPost(sdl.present.start);
+				break;
+			}
 			if (rectCount)
 				SDL_UpdateRects( sdl.surface, rectCount, sdl.updateRects );
 
@@ -825,6 +896,10 @@ void GFX_EndUpdate( const Bit16u *changedLines ) {
 			WastelandEXT::Update( sdl.surface );
 #endif
 		}
+		if (sdl.present.held) {
+			sdl.present.held=false;
+			SDL_SemPost(sdl.present.idle);
+		}
 		break;
 #if (HAVE_DDRAW_H) && defined(WIN32)
 	case SCREEN_SURFACE_DDRAW:
@@ -890,6 +965,7 @@ void GFX_EndUpdate( const Bit16u *changedLines ) {
 
 
 void GFX_SetPalette(Bitu start,Bitu count,GFX_PalEntry * entries) {
+	GFX_SyncPresent();
 	/* I should probably not change the GFX_PalEntry :) */
 	if (sdl.surface->flags & SDL_HWPALETTE) {
 		if (!SDL_SetPalette(sdl.surface,SDL_PHYSPAL,(SDL_Color *)entries,start,count)) {
@@ -938,6 +1014,16 @@ void GFX_Start() {
 
 static void GUI_ShutDown(Section * /*sec*/) {
 	GFX_Stop();
+	if (sdl.present.thread) {
+		sdl.present.quit=true;
+		SDL_SemPost(sdl.present.start);
+		SDL_WaitThread(sdl.present.thread,NULL);
+		sdl.present.thread=0;
+		if (sdl.present.frames) LOG_MSG("SDL:Presented %d frames, latency avg %d ms, max %d ms",
+			sdl.present.frames,(Bitu)(sdl.present.latency_total / sdl.present.frames),sdl.present.latency_max);
+		SDL_DestroySemaphore(sdl.present.start);
+		SDL_DestroySemaphore(sdl.present.idle);
+	}
 	if (sdl.draw.callback) (sdl.draw.callback)( GFX_CallBackStop );
 	if (sdl.mouse.locked) GFX_CaptureMouse();
 	if (sdl.desktop.fullscreen) GFX_SwitchFullScreen();
@@ -1364,6 +1450,19 @@ static void GUI_StartUp(Section * sec) {
 	SDLMod keystate = SDL_GetModState();
 	if(keystate&KMOD_NUM) startup_state_numlock = true;
 	if(keystate&KMOD_CAPS) startup_state_capslock = true;
+
+	if (section->Get_bool("presentthread")) {
+		sdl.present.start=SDL_CreateSemaphore(0);
+		sdl.present.idle=SDL_CreateSemaphore(1);
+		sdl.present.held=false;
+		sdl.present.quit=false;
+		sdl.present.thread=SDL_CreateThread(&GFX_PresentThread,0);
+		if (!sdl.present.thread) {
+			LOG_MSG("SDL:Can't start present thread, presenting inline");
+			SDL_DestroySemaphore(sdl.present.start);
+			SDL_DestroySemaphore(sdl.present.idle);
+		}
+	}
 }
 
 void Mouse_AutoLock(bool enable) {
@@ -1516,7 +1615,24 @@ void GFX_LosingFocus(void) {
 	MAPPER_LosingFocus();
 }
 
+static void GFX_HandleEvents(void);
+
 void GFX_Events() {
+	/* The video driver isn't safe to use from two threads, so events
+	   wait until the present thread has finished the current frame */
+	if (sdl.present.thread && !sdl.present.held) {
+		if (SDL_SemTryWait(sdl.present.idle))
+			return;
+		sdl.present.held=true;
+		GFX_HandleEvents();
+		sdl.present.held=false;
+		SDL_SemPost(sdl.present.idle);
+		return;
+	}
+	GFX_HandleEvents();
+}
+
+static void GFX_HandleEvents(void) {
 	SDL_Event event;
 #if defined (REDUCE_JOYSTICK_POLLING)
 	static int poll_delay=0;
@@ -1680,6 +1796,10 @@ void Config_Add_SDL() {
 	Pbool = sdl_sec->Add_bool("fulldouble",Property::Changeable::Always,false);
 	Pbool->Set_help("Use double buffering in fullscreen. It can reduce screen flickering, but it can also result in a slow DOSBox.");
 
+	Pbool = sdl_sec->Add_bool("presentthread",Property::Changeable::OnlyAtStart,false);
+	Pbool->Set_help("Show frames from a separate thread so slow screen updates don't stall emulation (output=surface only).\n"
+	                "  Frames finished while the previous one is still on its way to the screen are dropped.");
+
 	Pstring = sdl_sec->Add_string("fullresolution",Property::Changeable::Always,"original");
 	Pstring->Set_help("What resolution to use for fullscreen: original or fixed size (e.g. 1024x768).\n"
 	                  "  Using your monitor's native resolution with aspect=true might give the best results.\n"
@@ -1874,6 +1994,21 @@ static void erasemapperfile() {
 	exit(0);
 }
 
+static void compressimage() {
+	std::string arg,src,dst;
+	for (unsigned int i = 1; control->cmdline->FindCommand(i,arg); i++) {
+		if (strcasecmp(arg.c_str(),"-compressimage")) continue;
+		if (control->cmdline->FindCommand(i+1,src) && control->cmdline->FindCommand(i+2,dst)) {
+			Cross::ResolveHomedir(src);
+			Cross::ResolveHomedir(dst);
+			exit(compressedImage::Convert(src.c_str(),dst.c_str()) ? 0 : 1);
+		}
+		break;
+	}
+	printf("usage: dosbox -compressimage image compressedimage\n");
+	exit(1);
+}
+
 
 //extern void UI_Init(void);
 int main(int argc, char* argv[]) {
@@ -1938,6 +2073,7 @@ int main(int argc, char* argv[]) {
 			return 0;
 		}
 		if(control->cmdline->FindExist("-printconf")) printconfiglocation();
+		if(control->cmdline->FindExist("-compressimage")) compressimage();
 
 #if C_DEBUG
 		DEBUG_SetupConsole();
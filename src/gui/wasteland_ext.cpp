@@ -37,9 +37,6 @@
 
 #include <png.h>
 
-static int MAX_TARGET_W = 0;
-static int MAX_TARGET_H = 0;
-
 static int TARGET_W;
 static int TARGET_H;
 
@@ -53,6 +50,7 @@ static int rectCountPrev = 0;
 static SDL_Rect updateRects[32], updateRectsPrev[32];
 
 static void BeginBlit(int x, int y, int w, int h);
+static void SaveRect(int x, int y, int w, int h);
 
 static void Mouse_GetHQ3XCursor(int& x, int& y, int xOffset = 14, int yOffset = 5)
 {
@@ -298,6 +296,8 @@ struct Cursors
 
 			blitX *= 3; blitY *= 3; blitW *= 3; blitH *= 3;
 
+			SaveRect(blitX, blitY, blitW, blitH);
+
 			HD::Pix* src = &hd[cursor].pix[lookupOffsetX + HD::DIM * lookupOffsetY];
 			Bit8u* dst = outWrite + (blitY + CLIP_Y) * outPitch + (blitX + CLIP_X) * 4;
 			for( Bitu y = 0; y < blitH; ++y )
@@ -772,7 +772,16 @@ static Portraits* spPortraits;
 static Paragraphs* spParagraphs;
 static Cursors* spCursors;
 static void* sPixelCache;
-static Bit8u* sPixels = NULL;
+static Bitu sPixelPitch;
+
+// The scaler only redraws what changed in the source, so every pixel the
+// overlays cover is saved here and put back once the frame is presented.
+static std::vector<Bit8u> sSavedPixels;
+static std::vector<SDL_Rect> sSavedRects;
+// With the present thread the frame may still be going out after PostUpdate,
+// so its saved pixels wait here until the next frame starts drawing.
+static std::vector<Bit8u> sPendingPixels;
+static std::vector<SDL_Rect> sPendingRects;
 
 #include "stream_ogg.h"
 
@@ -806,12 +815,58 @@ void WastelandEXT::UpdateAudio(Bit8u* stream, int len)
 	}
 }
 
-static void BeginBlit(int x, int y, int w, int h)
+static void SaveRect(int x, int y, int w, int h)
 {
-	if( rectCount == 0 )
+	x += CLIP_X; y += CLIP_Y;
+	if( x < 0 ) { w += x; x = 0; }
+	if( y < 0 ) { h += y; y = 0; }
+	if( x + w > TARGET_W ) { w = TARGET_W - x; }
+	if( y + h > TARGET_H ) { h = TARGET_H - y; }
+	if( w <= 0 || h <= 0 )
+	{
+		return;
+	}
+
+	SDL_Rect rect;
+	rect.x = x; rect.y = y; rect.w = w; rect.h = h;
+	sSavedRects.push_back(rect);
+
+	size_t offset = sSavedPixels.size();
+	sSavedPixels.resize(offset + w * h * 4);
+	Bit8u* src = (Bit8u*)sPixelCache + y * sPixelPitch + x * 4;
+	for( int row = 0; row < h; ++row )
 	{
-		memcpy( sPixels, sPixelCache, TARGET_W*TARGET_H*4 );
+		memcpy( &sSavedPixels[offset], src, w * 4 );
+		offset += w * 4;
+		src += sPixelPitch;
 	}
+}
+
+static void RestoreRects(std::vector<SDL_Rect>& rects, std::vector<Bit8u>& pixels)
+{
+	// overlapping rects saved later hold overlay pixels of earlier ones,
+	// so undo them in reverse order
+	size_t offset = pixels.size();
+	while( !rects.empty() )
+	{
+		const SDL_Rect& rect = rects.back();
+		offset -= rect.w * rect.h * 4;
+		const Bit8u* src = &pixels[offset];
+		Bit8u* dst = (Bit8u*)sPixelCache + rect.y * sPixelPitch + rect.x * 4;
+		for( int row = 0; row < rect.h; ++row )
+		{
+			memcpy( dst, src, rect.w * 4 );
+			src += rect.w * 4;
+			dst += sPixelPitch;
+		}
+		rects.pop_back();
+	}
+	pixels.clear();
+}
+
+static void BeginBlit(int x, int y, int w, int h)
+{
+	SaveRect(x, y, w, h);
 
 	SDL_Rect* pNew = &updateRects[rectCount++];
 	pNew->x = x + CLIP_X;
@@ -1591,7 +1646,7 @@ void WastelandEXT::Init()
 
 void WastelandEXT::Purge()
 {
-	delete [] sPixels;
+	std::vector<Bit8u>().swap(sSavedPixels);
 	delete spCursors;
 	delete spParagraphs;
 	delete spLegal;
@@ -1654,15 +1709,7 @@ bool WastelandEXT::PreUpdate(Bitu width, Bitu height, Bitu bpp, Bitu pitch, Bit8
 		}
 		rectCount = 0;
 		sPixelCache = GFX_GetBlitPix(TARGET_W, TARGET_H);
-		if( TARGET_W*TARGET_H > MAX_TARGET_W*MAX_TARGET_H )
-		{
-			if( sPixels )
-			{
-				delete [] sPixels;
-			}
-			MAX_TARGET_W = TARGET_W; MAX_TARGET_H = TARGET_H;
-			sPixels = new Bit8u[ MAX_TARGET_W * MAX_TARGET_H * 4 ];
-		}
+		sPixelPitch = outPitch;
 
 		if( sPixelCache )
 		{
@@ -1768,13 +1815,37 @@ static Input sInput;
 
 void WastelandEXT::PostUpdate()
 {
-	if( rectCount > 0 )
+	if( !sSavedRects.empty() )
 	{
-		memcpy( sPixelCache, sPixels, TARGET_W*TARGET_H*4 );
+		if( GFX_PresentQueued() )
+		{
+			sPendingRects.swap( sSavedRects );
+			sPendingPixels.swap( sSavedPixels );
+		}
+		else
+		{
+			RestoreRects( sSavedRects, sSavedPixels );
+		}
 	}
 	sInput.Update();
 }
 
+void WastelandEXT::StartUpdate()
+{
+	if( sPendingRects.empty() )
+	{
+		return;
+	}
+	// a new mode or surface gets redrawn completely anyway
+	int w, h;
+	if( GFX_GetBlitPix(w, h) == sPixelCache && w == TARGET_W && h == TARGET_H )
+	{
+		RestoreRects( sPendingRects, sPendingPixels );
+	}
+	sPendingRects.clear();
+	sPendingPixels.clear();
+}
+
 bool WastelandEXT::KeyEvent(KBD_KEYS keytype,bool pressed)
 {
 	switch( keytype )
@@ -174,22 +174,84 @@ void mem_strcpy(PhysPt dest,PhysPt src) {
 	mem_writeb_inline(dest,0);
 }
 
+/* The block functions below work a page at a time and copy directly from/to
+   host memory when the tlb has a pointer for the page. Pages with handlers
+   (mmio, vga, code pages, not yet linked pages) are accessed a byte at a time,
+   the lookup is repeated after every byte as the handler may link the page. */
+
+static INLINE Bitu MEM_PageChunk(PhysPt pt,Bitu size) {
+	Bitu left=MEM_PAGE_SIZE-(pt & (MEM_PAGE_SIZE-1));
+	return (size<left) ? size : left;
+}
+
 void mem_memcpy(PhysPt dest,PhysPt src,Bitu size) {
-	while (size--) mem_writeb_inline(dest++,mem_readb_inline(src++));
+	while (size) {
+		Bitu chunk=MEM_PageChunk(src,size);
+		chunk=MEM_PageChunk(dest,chunk);
+		HostPt tlb_read=get_tlb_read(src);
+		HostPt tlb_write=get_tlb_write(dest);
+		if (tlb_read && tlb_write) {
+			HostPt hsrc=tlb_read+src;
+			HostPt hdest=tlb_write+dest;
+			if ((hdest>hsrc) && (hdest<hsrc+chunk)) {
+				/* Overlapping forward copy, keep the bytewise semantics */
+				for (Bitu i=0;i<chunk;i++) hdest[i]=hsrc[i];
+			} else memmove(hdest,hsrc,chunk);
+		} else {
+			chunk=1;
+			mem_writeb_inline(dest,mem_readb_inline(src));
+		}
+		dest+=chunk;src+=chunk;size-=chunk;
+	}
 }
 
 void MEM_BlockRead(PhysPt pt,void * data,Bitu size) {
 	Bit8u * write=reinterpret_cast<Bit8u *>(data);
-	while (size--) {
-		*write++=mem_readb_inline(pt++);
+	while (size) {
+		Bitu chunk=MEM_PageChunk(pt,size);
+		HostPt tlb_addr=get_tlb_read(pt);
+		if (tlb_addr) memcpy(write,tlb_addr+pt,chunk);
+		else {
+			chunk=1;
+			*write=mem_readb_inline(pt);
+		}
+		write+=chunk;pt+=chunk;size-=chunk;
 	}
 }
 
 void MEM_BlockWrite(PhysPt pt,void const * const data,Bitu size) {
 	Bit8u const * read = reinterpret_cast<Bit8u const * const>(data);
-	while (size--) {
-		mem_writeb_inline(pt++,*read++);
+	while (size) {
+		Bitu chunk=MEM_PageChunk(pt,size);
+		HostPt tlb_addr=get_tlb_write(pt);
+		if (tlb_addr) memcpy(tlb_addr+pt,read,chunk);
+		else {
+			chunk=1;
+			mem_writeb_inline(pt,*read);
+		}
+		read+=chunk;pt+=chunk;size-=chunk;
+	}
+}
+
+HostPt MEM_GetBlockReadPt(PhysPt pt,Bitu size) {
+	if (!size || (pt+size<pt)) return 0;
+	HostPt tlb_addr=get_tlb_read(pt);
+	if (!tlb_addr) return 0;
+	/* The following pages have to continue the same host block */
+	for (PhysPt page=(pt&~0xfff)+4096;page-pt<size;page+=4096) {
+		if (get_tlb_read(page)!=tlb_addr) return 0;
+	}
+	return tlb_addr+pt;
+}
+
+HostPt MEM_GetBlockWritePt(PhysPt pt,Bitu size) {
+	if (!size || (pt+size<pt)) return 0;
+	HostPt tlb_addr=get_tlb_write(pt);
+	if (!tlb_addr) return 0;
+	for (PhysPt page=(pt&~0xfff)+4096;page-pt<size;page+=4096) {
+		if (get_tlb_write(page)!=tlb_addr) return 0;
 	}
+	return tlb_addr+pt;
 }
 
 void MEM_BlockCopy(PhysPt dest,PhysPt src,Bitu size) {
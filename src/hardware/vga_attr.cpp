@@ -25,6 +25,7 @@
 #define attr(blah) vga.attr.blah
 
 void VGA_ATTR_SetPalette(Bit8u index,Bit8u val) {
+	VGA_FrameCatchUp();
 	vga.attr.palette[index] = val;
 	if (vga.attr.mode_control & 0x80) val = (val&0xf) | (vga.attr.color_select << 4);
 	val &= 63;
@@ -89,6 +90,7 @@ void write_p3c0(Bitu /*port*/,Bitu val,Bitu iolen) {
 			}
 			if ((attr(mode_control) ^ val) & 0x04) {
 				attr(mode_control)=(Bit8u)val;
+				vga.draw.glyph_gen++;	// the cached rows hold the 9th column
 				VGA_DetermineMode();
 				if ((IS_VGA_ARCH) && (svgaCard==SVGA_None)) VGA_StartResize();
 			} else {
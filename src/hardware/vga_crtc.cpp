@@ -105,6 +105,7 @@ void vga_write_p3d5(Bitu port,Bitu val,Bitu iolen) {
 		*/
 		break;
 	case 0x07:	/* Overflow Register */
+		VGA_FrameCatchUp();
 		//Line compare bit ignores read only */
 		vga.config.line_compare=(vga.config.line_compare & 0x6ff) | (val & 0x10) << 4;
 		if (crtc(read_only)) break;
@@ -138,6 +139,7 @@ void vga_write_p3d5(Bitu port,Bitu val,Bitu iolen) {
 		*/
 		break;
 	case 0x09: /* Maximum Scan Line Register */
+		VGA_FrameCatchUp();
 		if (IS_VGA_ARCH)
 			vga.config.line_compare=(vga.config.line_compare & 0x5ff)|(val&0x40)<<3;
 
@@ -262,6 +264,7 @@ void vga_write_p3d5(Bitu port,Bitu val,Bitu iolen) {
 		*/
 		break;
 	case 0x13:	/* Offset register */
+		VGA_FrameCatchUp();
 		crtc(offset)=val;
 		vga.config.scan_len&=0x300;
 		vga.config.scan_len|=val;
@@ -272,7 +275,12 @@ void vga_write_p3d5(Bitu port,Bitu val,Bitu iolen) {
 		*/
 		break;
 	case 0x14:	/* Underline Location Register */
-		crtc(underline_location)=val;
+		if (IS_VGA_ARCH && ((crtc(underline_location) ^ val) & 0x40)) {
+			crtc(underline_location)=val;
+			// dword mode decides if chain-4 memory can be mapped directly
+			VGA_SetupHandlers();
+		} else crtc(underline_location)=val;
+		vga.draw.glyph_gen++;
 		if (IS_VGA_ARCH) {
 			//Byte,word,dword mode
 			if ( crtc(underline_location) & 0x20 )
@@ -345,6 +353,7 @@ void vga_write_p3d5(Bitu port,Bitu val,Bitu iolen) {
 		*/
 		break;
 	case 0x18:	/* Line Compare Register */
+		VGA_FrameCatchUp();
 		crtc(line_compare)=val;
 		vga.config.line_compare=(vga.config.line_compare & 0x700) | val;
 		/*
@@ -57,7 +57,12 @@ static void VGA_DAC_SendColor( Bitu index, Bitu src ) {
 	//Set entry in 16bit output lookup table
 	vga.dac.xlat16[index] = ((blue>>1)&0x1f) | (((green)&0x3f)<<5) | (((red>>1)&0x1f) << 11);
 	
-	RENDER_SetPal( index, (red << 2) | ( red >> 4 ), (green << 2) | ( green >> 4 ), (blue << 2) | ( blue >> 4 ) );
+	if (!RENDER_SetPal( index, (red << 2) | ( red >> 4 ), (green << 2) | ( green >> 4 ), (blue << 2) | ( blue >> 4 ) ))
+		return;
+	// xlat16 lines change without any memory write
+	vga.dirty.skip = false;
+	vga.dirty.invalid = true;
+	vga.draw.glyph_gen++;
 }
 
 static void VGA_DAC_UpdateColor( Bitu index ) {
@@ -114,6 +119,7 @@ static void write_p3c9(Bitu port,Bitu val,Bitu iolen) {
 		vga.dac.pel_index=2;
 		break;
 	case 2:
+		VGA_FrameCatchUp();
 		vga.dac.rgb[vga.dac.write_index].blue=val;
 		switch (vga.mode) {
 		case M_VGA:
@@ -26,6 +26,7 @@
 #include "../gui/render_scalers.h"
 #include "vga.h"
 #include "pic.h"
+#include "cross.h"
 
 //#undef C_DEBUG
 //#define C_DEBUG 1
@@ -191,7 +192,10 @@ static Bit8u * VGA_Draw_Linear_Line(Bitu vidstart, Bitu /*line*/) {
 }
 
 static Bit8u * VGA_Draw_Xlat16_Linear_Line(Bitu vidstart, Bitu /*line*/) {
-	Bit8u *ret = &vga.draw.linear_base[ vidstart & vga.draw.linear_mask ];
+	Bitu offset = vidstart & vga.draw.linear_mask;
+	if (vga.draw.linear_mask-offset < vga.draw.line_length)
+		memcpy(vga.draw.linear_base+vga.draw.linear_mask+1, vga.draw.linear_base, vga.draw.line_length);
+	Bit8u *ret = &vga.draw.linear_base[ offset ];
 	Bit16u* temps = (Bit16u*) TempLine;
 	for(Bitu i = 0; i < vga.draw.line_length; i++) {
 		temps[i]=vga.dac.xlat16[ret[i]];
@@ -362,6 +366,28 @@ static const Bit8u* VGA_Text_Memwrap(Bitu vidstart) {
 }
 
 static Bit32u FontMask[2]={0xffffffff,0x0};
+
+/* Rendered rows of character cells, only valid for the glyph_gen they were
+   drawn with. The font, palette, blinking or draw handler changing bumps it. */
+#define GLYPH_CACHE_BITS	13
+static struct GlyphRow {
+	Bit32u key, gen;
+	union {
+		Bit32u pix8[2];
+		Bit16u pix16[9];
+	};
+} GlyphCache[1 << GLYPH_CACHE_BITS];
+
+static INLINE GlyphRow * VGA_GlyphLookup(Bitu chr, Bitu col, Bitu line, bool & hit) {
+	Bit32u key = (Bit32u)(chr | (col << 8) | (line << 16));
+	if (!FontMask[col >> 7]) key |= 1 << 24;
+	GlyphRow * row = &GlyphCache[(key * 2654435761u) >> (32 - GLYPH_CACHE_BITS)];
+	hit = (row->key == key) && (row->gen == vga.draw.glyph_gen);
+	row->key = key;
+	row->gen = vga.draw.glyph_gen;
+	return row;
+}
+
 static Bit8u * VGA_TEXT_Draw_Line(Bitu vidstart, Bitu line) {
 	Bits font_addr;
 	Bit32u * draw=(Bit32u *)TempLine;
@@ -369,13 +395,19 @@ static Bit8u * VGA_TEXT_Draw_Line(Bitu vidstart, Bitu line) {
 	for (Bitu cx=0;cx<vga.draw.blocks;cx++) {
 		Bitu chr=vidmem[cx*2];
 		Bitu col=vidmem[cx*2+1];
-		Bitu font=vga.draw.font_tables[(col >> 3)&1][chr*32+line];
-		Bit32u mask1=TXT_Font_Table[font>>4] & FontMask[col >> 7];
-		Bit32u mask2=TXT_Font_Table[font&0xf] & FontMask[col >> 7];
-		Bit32u fg=TXT_FG_Table[col&0xf];
-		Bit32u bg=TXT_BG_Table[col>>4];
-		*draw++=(fg&mask1) | (bg&~mask1);
-		*draw++=(fg&mask2) | (bg&~mask2);
+		bool hit;
+		GlyphRow * row=VGA_GlyphLookup(chr,col,line,hit);
+		if (!hit) {
+			Bitu font=vga.draw.font_tables[(col >> 3)&1][chr*32+line];
+			Bit32u mask1=TXT_Font_Table[font>>4] & FontMask[col >> 7];
+			Bit32u mask2=TXT_Font_Table[font&0xf] & FontMask[col >> 7];
+			Bit32u fg=TXT_FG_Table[col&0xf];
+			Bit32u bg=TXT_BG_Table[col>>4];
+			row->pix8[0]=(fg&mask1) | (bg&~mask1);
+			row->pix8[1]=(fg&mask2) | (bg&~mask2);
+		}
+		*draw++=row->pix8[0];
+		*draw++=row->pix8[1];
 	}
 	if (!vga.draw.cursor.enabled || !(vga.draw.cursor.count&0x8)) goto skip_cursor;
 	font_addr = (vga.draw.cursor.address-vidstart) >> 1;
@@ -454,21 +486,27 @@ static Bit8u * VGA_TEXT_Xlat16_Draw_Line(Bitu vidstart, Bitu line) {
 	for (Bitu cx=0;cx<vga.draw.blocks;cx++) {
 		Bitu chr=vidmem[cx*2];
 		Bitu col=vidmem[cx*2+1];
-		Bitu font=vga.draw.font_tables[(col >> 3)&1][chr*32+line];
-		Bit32u mask1=TXT_Font_Table[font>>4] & FontMask[col >> 7];
-		Bit32u mask2=TXT_Font_Table[font&0xf] & FontMask[col >> 7];
-		Bit32u fg=TXT_FG_Table[col&0xf];
-		Bit32u bg=TXT_BG_Table[col>>4];
-		
-		mask1=(fg&mask1) | (bg&~mask1);
-		mask2=(fg&mask2) | (bg&~mask2);
+		bool hit;
+		GlyphRow * row=VGA_GlyphLookup(chr,col,line,hit);
+		if (!hit) {
+			Bitu font=vga.draw.font_tables[(col >> 3)&1][chr*32+line];
+			Bit32u mask1=TXT_Font_Table[font>>4] & FontMask[col >> 7];
+			Bit32u mask2=TXT_Font_Table[font&0xf] & FontMask[col >> 7];
+			Bit32u fg=TXT_FG_Table[col&0xf];
+			Bit32u bg=TXT_BG_Table[col>>4];
+			
+			mask1=(fg&mask1) | (bg&~mask1);
+			mask2=(fg&mask2) | (bg&~mask2);
 
-		for(int i = 0; i < 4; i++) {
-			*draw++ = vga.dac.xlat16[(mask1>>8*i)&0xff];
-		}
-		for(int i = 0; i < 4; i++) {
-			*draw++ = vga.dac.xlat16[(mask2>>8*i)&0xff];
+			for(int i = 0; i < 4; i++) {
+				row->pix16[i] = vga.dac.xlat16[(mask1>>8*i)&0xff];
+			}
+			for(int i = 0; i < 4; i++) {
+				row->pix16[4+i] = vga.dac.xlat16[(mask2>>8*i)&0xff];
+			}
 		}
+		memcpy(draw,row->pix16,8*sizeof(Bit16u));
+		draw+=8;
 	}
 	if (!vga.draw.cursor.enabled || !(vga.draw.cursor.count&0x8)) goto skip_cursor;
 	font_addr = (vga.draw.cursor.address-vidstart) >> 1;
@@ -561,6 +599,7 @@ static Bit8u * VGA_TEXT_Xlat16_Draw_Line_9(Bitu vidstart, Bitu line) {
 	Bitu draw_blocks=vga.draw.blocks;
 	draw_blocks++;
 	for (Bitu cx=1;cx<draw_blocks;cx++) {
+		GlyphRow * row=0;
 		if (pel_pan) {
 			chr=vidmem[cx*2];
 			col=vidmem[cx*2+1];
@@ -571,6 +610,13 @@ static Bit8u * VGA_TEXT_Xlat16_Draw_Line_9(Bitu vidstart, Bitu line) {
 		} else {
 			chr=vidmem[(cx-1)*2];
 			col=vidmem[(cx-1)*2+1];
+			bool hit;
+			row=VGA_GlyphLookup(chr,col,line,hit);
+			if (hit) {
+				memcpy(draw,row->pix16,9*sizeof(Bit16u));
+				draw+=9;
+				continue;
+			}
 			if (underline && ((col&0x07) == 0x01)) font=0xff;
 			else font=vga.draw.font_tables[(col >> 3)&1][chr*32+line];
 			fg=col&0xf;
@@ -587,6 +633,7 @@ static Bit8u * VGA_TEXT_Xlat16_Draw_Line_9(Bitu vidstart, Bitu line) {
 		*draw++=(((vga.attr.mode_control&0x04) && ((chr<0xc0) || (chr>0xdf))) && 
 			!(underline && ((col&0x07) == 0x01))) ? 
 			(vga.dac.xlat16[bg]) : lastval;
+		if (row) memcpy(row->pix16,draw-9,9*sizeof(Bit16u));
 		if (pel_pan) {
 			if (underline && ((col&0x07) == 0x01)) font=0xff;
 			else font=(vga.draw.font_tables[(col >> 3)&1][chr*32+line])<<pel_pan;
@@ -627,6 +674,32 @@ static INLINE void VGA_ChangesEnd(void ) {
 #endif
 
 
+static Bitu LineKeys[SCALER_MAXHEIGHT];
+static Bit8u * LineKeysBase;
+
+/* Lines reading the same memory as last frame that has not been written to
+   since don't need to be generated, a 0 makes the render keep its cached line */
+static INLINE Bit8u * VGA_DrawDirtyLine(void) {
+	if (vga.dirty.tracked && vga.draw.lines_done < SCALER_MAXHEIGHT) {
+		Bitu key = (vga.draw.address << 5) | vga.draw.address_line;
+		Bitu & last = LineKeys[vga.draw.lines_done];
+		if (last != key) last = key;
+		else if (vga.dirty.skip) {
+			Bitu start = vga.draw.address & vga.draw.linear_mask;
+			Bitu end = start + vga.draw.line_length - 1;
+			if (end <= vga.draw.linear_mask) {
+				start >>= VGA_DIRTY_SHIFT;
+				end >>= VGA_DIRTY_SHIFT;
+				for (;start <= end;start++) {
+					if ((Bit8u)(vga.dirty.frame - vga.dirty.map[start]) < 2) break;
+				}
+				if (start > end) return 0;
+			}
+		}
+	}
+	return VGA_DrawLine( vga.draw.address, vga.draw.address_line );
+}
+
 static void VGA_ProcessSplit() {
 	// On the EGA the address is always reset to 0.
 	if ((vga.attr.mode_control&0x20) || (machine==MCH_EGA)) {
@@ -641,14 +714,18 @@ static void VGA_ProcessSplit() {
 }
 
 static void VGA_DrawSingleLine(Bitu /*blah*/) {
+	Bit64u drawStart = render.frameskip.autoAdjust ? Cross::GetMicroTicks() : 0;
 	if (GCC_UNLIKELY(vga.attr.disabled)) {
 		// draw blanked line (DoWhackaDo, Alien Carnage, TV sports Football)
 		memset(TempLine, 0, sizeof(TempLine));
 		RENDER_DrawLine(TempLine);
+		vga.dirty.skip = false;
+		vga.dirty.invalid = true;
 	} else {
-		Bit8u * data=VGA_DrawLine( vga.draw.address, vga.draw.address_line );	
+		Bit8u * data=VGA_DrawDirtyLine();
 		RENDER_DrawLine(data);
 	}
+	if (drawStart) render.frameskip.drawMicros += Cross::GetMicroTicks() - drawStart;
 
 	vga.draw.address_line++;
 	if (vga.draw.address_line>=vga.draw.address_line_total) {
@@ -662,9 +739,10 @@ static void VGA_DrawSingleLine(Bitu /*blah*/) {
 	} else RENDER_EndUpdate(false);
 }
 
-static void VGA_DrawPart(Bitu lines) {
+static INLINE void VGA_DrawLines(Bitu lines) {
+	Bit64u drawStart = render.frameskip.autoAdjust ? Cross::GetMicroTicks() : 0;
 	while (lines--) {
-		Bit8u * data=VGA_DrawLine( vga.draw.address, vga.draw.address_line );
+		Bit8u * data=VGA_DrawDirtyLine();
 		RENDER_DrawLine(data);
 		vga.draw.address_line++;
 		if (vga.draw.address_line>=vga.draw.address_line_total) {
@@ -682,6 +760,11 @@ static void VGA_DrawPart(Bitu lines) {
 #endif
 		}
 	}
+	if (drawStart) render.frameskip.drawMicros += Cross::GetMicroTicks() - drawStart;
+}
+
+static void VGA_DrawPart(Bitu lines) {
+	VGA_DrawLines(lines);
 	if (--vga.draw.parts_left) {
 		PIC_AddEvent(VGA_DrawPart,(float)vga.draw.delay.parts,
 			 (vga.draw.parts_left!=1) ? vga.draw.parts_lines  : (vga.draw.lines_total - vga.draw.lines_done));
@@ -693,8 +776,33 @@ static void VGA_DrawPart(Bitu lines) {
 	}
 }
 
+static void VGA_DrawFrame(Bitu /*val*/) {
+	VGA_DrawLines(vga.draw.lines_total - vga.draw.lines_done);
+	vga.draw.parts_left = 0;
+#ifdef VGA_KEEP_CHANGES
+	VGA_ChangesEnd();
+#endif
+	RENDER_EndUpdate(false);
+}
+
+/* A register that affects the visible frame is about to change while the
+   frame is drawn at once: draw the lines the beam has passed with the old
+   state and fall back to drawing in parts from the next frame on. */
+void VGA_FrameCatchUp(void) {
+	if (vga.draw.mode!=FRAME || !vga.draw.parts_left) return;
+	double elapsed = PIC_FullIndex() - vga.draw.delay.framestart -
+		vga.draw.delay.htotal * vga.draw.vblank_skip;
+	if (elapsed <= 0.0) return;
+	Bitu line = (Bitu)(elapsed * vga.draw.lines_total / vga.draw.delay.vdend);
+	if (line >= vga.draw.lines_total) return;
+	if (line > vga.draw.lines_done) VGA_DrawLines(line - vga.draw.lines_done);
+	LOG(LOG_VGAMISC,LOG_NORMAL)("Raster change at line %d, drawing in parts",line);
+	vga.draw.mode = (machine==MCH_VGA && svgaCard==SVGA_None) ? LINE : PART;
+}
+
 void VGA_SetBlinking(Bitu enabled) {
 	Bitu b;
+	vga.draw.glyph_gen++;
 	LOG(LOG_VGA,LOG_NORMAL)("Blinking %d",enabled);
 	if (enabled) {
 		b=0;vga.draw.blinking=1; //used to -1 but blinking is unsigned
@@ -883,6 +991,8 @@ static void VGA_VerticalTimer(Bitu /*val*/) {
 			LOG(LOG_VGAMISC,LOG_NORMAL)( "Parts left: %d", vga.draw.parts_left );
 			PIC_RemoveEvents(VGA_DrawPart);
 			RENDER_EndUpdate(true);
+			// the rest of the last frame never got drawn
+			vga.dirty.invalid = true;
 		}
 		vga.draw.lines_done = 0;
 		vga.draw.parts_left = vga.draw.parts_total;
@@ -894,12 +1004,36 @@ static void VGA_VerticalTimer(Bitu /*val*/) {
 				vga.draw.lines_total-vga.draw.lines_done);
 			PIC_RemoveEvents(VGA_DrawSingleLine);
 			RENDER_EndUpdate(true);
+			vga.dirty.invalid = true;
 		}
 		vga.draw.lines_done = 0;
 		PIC_AddEvent(VGA_DrawSingleLine,(float)(vga.draw.delay.htotal/4.0 + draw_skip));
 		break;
+	case FRAME:
+		if (GCC_UNLIKELY(vga.draw.parts_left)) {
+			LOG(LOG_VGAMISC,LOG_NORMAL)( "Frame left: %d lines",
+				vga.draw.lines_total-vga.draw.lines_done);
+			PIC_RemoveEvents(VGA_DrawFrame);
+			RENDER_EndUpdate(true);
+			vga.dirty.invalid = true;
+		}
+		vga.draw.lines_done = 0;
+		vga.draw.parts_left = 1;
+		PIC_AddEvent(VGA_DrawFrame,(float)vga.draw.delay.vdend + draw_skip);
+		break;
 	//case EGALINE:
 	}
+
+	// stamp the frame once it is committed to be drawn
+	vga.dirty.frame++;
+	VGA_ChainedDirectFrame();
+	if (vga.draw.linear_base != LineKeysBase) {
+		LineKeysBase = vga.draw.linear_base;
+		vga.dirty.invalid = true;
+	}
+	vga.dirty.skip = vga.dirty.tracked && !vga.dirty.invalid && !render.fullFrame &&
+		(VGA_DrawLine == VGA_Draw_Linear_Line || VGA_DrawLine == VGA_Draw_Xlat16_Linear_Line);
+	vga.dirty.invalid = false;
 }
 
 void VGA_CheckScanLength(void) {
@@ -976,6 +1110,8 @@ void VGA_SetupDrawing(Bitu /*val*/) {
 		PIC_RemoveEvents(VGA_DisplayStartLatch);
 		return;
 	}
+	vga.dirty.invalid = true;
+	vga.draw.glyph_gen++;
 	// set the drawing mode
 	switch (machine) {
 	case MCH_CGA:
@@ -992,6 +1128,7 @@ void VGA_SetupDrawing(Bitu /*val*/) {
 		vga.draw.mode = PART;
 		break;
 	}
+	if (render.frameAtOnce && IS_EGAVGA_ARCH) vga.draw.mode = FRAME;
 	
 	/* Calculate the FPS for this screen */
 	double fps; Bitu clock;
@@ -1492,7 +1629,9 @@ void VGA_SetupDrawing(Bitu /*val*/) {
 void VGA_KillDrawing(void) {
 	PIC_RemoveEvents(VGA_DrawPart);
 	PIC_RemoveEvents(VGA_DrawSingleLine);
+	PIC_RemoveEvents(VGA_DrawFrame);
 	vga.draw.parts_left = 0;
 	vga.draw.lines_done = ~0;
+	vga.dirty.invalid = true;
 	RENDER_EndUpdate(true);
 }
@@ -28,6 +28,13 @@
 #include "inout.h"
 #include "setup.h"
 
+// the sse2 unit expands planes to pixels without the table lookups,
+// disable this to always use Expand16Table
+#if defined(__SSE2__) || defined(_M_X64)
+#define VGA_SSE2_EXPAND
+#include <emmintrin.h>
+#endif
+
 
 #ifndef C_VGARAM_CHECKED
 #define C_VGARAM_CHECKED 1
@@ -54,6 +61,9 @@
 #define MEM_CHANGED( _MEM ) 
 #endif
 
+/* Stamp the current frame into the dirty map, _MEM is an offset in the memory the draw handlers read */
+#define VGA_DIRTY( _MEM ) vga.dirty.map[ (_MEM) >> VGA_DIRTY_SHIFT ] = vga.dirty.frame;
+
 #define TANDY_VIDBASE(_X_)  &MemBase[ 0x80000 + (_X_)]
 
 template <class Size>
@@ -136,6 +146,42 @@ static struct {
 	Bitu base, mask;
 } vgapages;
 	
+/* Convert the four planes of a latch into eight 16-colour pixels */
+static INLINE void VGA_ExpandPlanes(Bit8u * write_pixels, Bit32u planes) {
+#if defined(VGA_SSE2_EXPAND)
+	// spread every plane byte over eight lanes, test one bit per lane
+	const __m128i bits = _mm_set_epi8(1,2,4,8,16,32,64,-128,1,2,4,8,16,32,64,-128);
+	__m128i p = _mm_cvtsi32_si128(planes);
+	p = _mm_unpacklo_epi8(p,p);
+	p = _mm_unpacklo_epi16(p,p);
+	__m128i p01 = _mm_unpacklo_epi32(p,p);
+	__m128i p23 = _mm_unpackhi_epi32(p,p);
+	p01 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(p01,bits),bits),
+		_mm_set_epi8(2,2,2,2,2,2,2,2,1,1,1,1,1,1,1,1));
+	p23 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(p23,bits),bits),
+		_mm_set_epi8(8,8,8,8,8,8,8,8,4,4,4,4,4,4,4,4));
+	p = _mm_or_si128(p01,p23);
+	p = _mm_or_si128(p,_mm_srli_si128(p,8));
+	_mm_storel_epi64((__m128i *)write_pixels,p);
+#else
+	Bit32u colors0_3, colors4_7;
+	VGA_Latch temp;temp.d=(planes>>4) & 0x0f0f0f0f;
+	colors0_3 = 
+		Expand16Table[0][temp.b[0]] |
+		Expand16Table[1][temp.b[1]] |
+		Expand16Table[2][temp.b[2]] |
+		Expand16Table[3][temp.b[3]];
+	*(Bit32u *)write_pixels=colors0_3;
+	temp.d=planes & 0x0f0f0f0f;
+	colors4_7 = 
+		Expand16Table[0][temp.b[0]] |
+		Expand16Table[1][temp.b[1]] |
+		Expand16Table[2][temp.b[2]] |
+		Expand16Table[3][temp.b[3]];
+	*(Bit32u *)(write_pixels+4)=colors4_7;
+#endif
+}
+
 class VGA_UnchainedRead_Handler : public PageHandler {
 public:
 	Bitu readHandler(PhysPt start) {
@@ -190,23 +236,7 @@ public:
 		start >>= 2;
 		pixels.d=((Bit32u*)vga.mem.linear)[start];
 
-		Bit8u * write_pixels=&vga.fastmem[start<<3];
-
-		Bit32u colors0_3, colors4_7;
-		VGA_Latch temp;temp.d=(pixels.d>>4) & 0x0f0f0f0f;
-		colors0_3 = 
-			Expand16Table[0][temp.b[0]] |
-			Expand16Table[1][temp.b[1]] |
-			Expand16Table[2][temp.b[2]] |
-			Expand16Table[3][temp.b[3]];
-		*(Bit32u *)write_pixels=colors0_3;
-		temp.d=pixels.d & 0x0f0f0f0f;
-		colors4_7 = 
-			Expand16Table[0][temp.b[0]] |
-			Expand16Table[1][temp.b[1]] |
-			Expand16Table[2][temp.b[2]] |
-			Expand16Table[3][temp.b[3]];
-		*(Bit32u *)(write_pixels+4)=colors4_7;
+		VGA_ExpandPlanes(&vga.fastmem[start<<3],pixels.d);
 	}
 public:	
 	VGA_ChainedEGA_Handler()  {
@@ -217,6 +247,7 @@ public:
 		addr += vga.svga.bank_write_full;
 		addr = CHECKED(addr);
 		MEM_CHANGED( addr << 3);
+		VGA_DIRTY( (addr >> 2) << 3 );
 		writeHandler(addr+0,(Bit8u)(val >> 0));
 	}
 	void writew(PhysPt addr,Bitu val) {
@@ -224,6 +255,8 @@ public:
 		addr += vga.svga.bank_write_full;
 		addr = CHECKED(addr);
 		MEM_CHANGED( addr << 3);
+		VGA_DIRTY( (addr >> 2) << 3 );
+		VGA_DIRTY( ((addr+1) >> 2) << 3 );
 		writeHandler(addr+0,(Bit8u)(val >> 0));
 		writeHandler(addr+1,(Bit8u)(val >> 8));
 	}
@@ -232,6 +265,8 @@ public:
 		addr += vga.svga.bank_write_full;
 		addr = CHECKED(addr);
 		MEM_CHANGED( addr << 3);
+		VGA_DIRTY( (addr >> 2) << 3 );
+		VGA_DIRTY( ((addr+3) >> 2) << 3 );
 		writeHandler(addr+0,(Bit8u)(val >> 0));
 		writeHandler(addr+1,(Bit8u)(val >> 8));
 		writeHandler(addr+2,(Bit8u)(val >> 16));
@@ -274,23 +309,7 @@ public:
 		pixels.d&=vga.config.full_not_map_mask;
 		pixels.d|=(data & vga.config.full_map_mask);
 		((Bit32u*)vga.mem.linear)[start]=pixels.d;
-		Bit8u * write_pixels=&vga.fastmem[start<<3];
-
-		Bit32u colors0_3, colors4_7;
-		VGA_Latch temp;temp.d=(pixels.d>>4) & 0x0f0f0f0f;
-			colors0_3 = 
-			Expand16Table[0][temp.b[0]] |
-			Expand16Table[1][temp.b[1]] |
-			Expand16Table[2][temp.b[2]] |
-			Expand16Table[3][temp.b[3]];
-		*(Bit32u *)write_pixels=colors0_3;
-		temp.d=pixels.d & 0x0f0f0f0f;
-		colors4_7 = 
-			Expand16Table[0][temp.b[0]] |
-			Expand16Table[1][temp.b[1]] |
-			Expand16Table[2][temp.b[2]] |
-			Expand16Table[3][temp.b[3]];
-		*(Bit32u *)(write_pixels+4)=colors4_7;
+		VGA_ExpandPlanes(&vga.fastmem[start<<3],pixels.d);
 	}
 public:	
 	VGA_UnchainedEGA_Handler()  {
@@ -301,6 +320,7 @@ public:
 		addr += vga.svga.bank_write_full;
 		addr = CHECKED2(addr);
 		MEM_CHANGED( addr << 3);
+		VGA_DIRTY( addr << 3 );
 		writeHandler<true>(addr+0,(Bit8u)(val >> 0));
 	}
 	void writew(PhysPt addr,Bitu val) {
@@ -308,6 +328,8 @@ public:
 		addr += vga.svga.bank_write_full;
 		addr = CHECKED2(addr);
 		MEM_CHANGED( addr << 3);
+		VGA_DIRTY( addr << 3 );
+		VGA_DIRTY( (addr+1) << 3 );
 		writeHandler<true>(addr+0,(Bit8u)(val >> 0));
 		writeHandler<true>(addr+1,(Bit8u)(val >> 8));
 	}
@@ -316,6 +338,8 @@ public:
 		addr += vga.svga.bank_write_full;
 		addr = CHECKED2(addr);
 		MEM_CHANGED( addr << 3);
+		VGA_DIRTY( addr << 3 );
+		VGA_DIRTY( (addr+3) << 3 );
 		writeHandler<true>(addr+0,(Bit8u)(val >> 0));
 		writeHandler<true>(addr+1,(Bit8u)(val >> 8));
 		writeHandler<true>(addr+2,(Bit8u)(val >> 16));
@@ -381,6 +405,8 @@ public:
 		addr += vga.svga.bank_write_full;
 		addr = CHECKED(addr);
 		MEM_CHANGED( addr );
+		VGA_DIRTY( addr );
+		VGA_DIRTY( (addr&~3)<<2 );
 		writeHandler<Bit8u>( addr, val );
 		writeCache<Bit8u>( addr, val );
 	}
@@ -390,6 +416,10 @@ public:
 		addr = CHECKED(addr);
 		MEM_CHANGED( addr );
 //		MEM_CHANGED( addr + 1);
+		VGA_DIRTY( addr );
+		VGA_DIRTY( addr+1 );
+		VGA_DIRTY( (addr&~3)<<2 );
+		VGA_DIRTY( ((addr+1)&~3)<<2 );
 		if (GCC_UNLIKELY(addr & 1)) {
 			writeHandler<Bit8u>( addr+0, val >> 0 );
 			writeHandler<Bit8u>( addr+1, val >> 8 );
@@ -404,6 +434,10 @@ public:
 		addr = CHECKED(addr);
 		MEM_CHANGED( addr );
 //		MEM_CHANGED( addr + 3);
+		VGA_DIRTY( addr );
+		VGA_DIRTY( addr+3 );
+		VGA_DIRTY( (addr&~3)<<2 );
+		VGA_DIRTY( ((addr+3)&~3)<<2 );
 		if (GCC_UNLIKELY(addr & 3)) {
 			writeHandler<Bit8u>( addr+0, val >> 0 );
 			writeHandler<Bit8u>( addr+1, val >> 8 );
@@ -437,6 +471,7 @@ public:
 		addr += vga.svga.bank_write_full;
 		addr = CHECKED2(addr);
 		MEM_CHANGED( addr << 2 );
+		VGA_DIRTY( addr << 2 );
 		writeHandler(addr+0,(Bit8u)(val >> 0));
 	}
 	void writew(PhysPt addr,Bitu val) {
@@ -444,6 +479,8 @@ public:
 		addr += vga.svga.bank_write_full;
 		addr = CHECKED2(addr);
 		MEM_CHANGED( addr << 2);
+		VGA_DIRTY( addr << 2 );
+		VGA_DIRTY( (addr+1) << 2 );
 		writeHandler(addr+0,(Bit8u)(val >> 0));
 		writeHandler(addr+1,(Bit8u)(val >> 8));
 	}
@@ -452,6 +489,8 @@ public:
 		addr += vga.svga.bank_write_full;
 		addr = CHECKED2(addr);
 		MEM_CHANGED( addr << 2);
+		VGA_DIRTY( addr << 2 );
+		VGA_DIRTY( (addr+3) << 2 );
 		writeHandler(addr+0,(Bit8u)(val >> 0));
 		writeHandler(addr+1,(Bit8u)(val >> 8));
 		writeHandler(addr+2,(Bit8u)(val >> 16));
@@ -472,6 +511,7 @@ public:
 		addr = PAGING_GetPhysicalAddress(addr) & vgapages.mask;
 		if (vga.seq.map_mask & 0x4) {
 			vga.draw.font[addr]=(Bit8u)val;
+			vga.draw.glyph_gen++;
 		}
 	}
 };
@@ -491,6 +531,44 @@ public:
 	}
 };
 
+static void VGA_ChainedDirectWrite(PhysPt addr);
+
+// Chain-4 writes don't depend on any register, so the copy in fastmem can be mapped directly.
+// Pages start out read only, the first write in a frame stamps the page and maps it writable.
+class VGA_ChainedDirect_Handler : public PageHandler {
+public:
+	VGA_ChainedDirect_Handler() {
+		flags=PFLAG_READABLE|PFLAG_NOCODE;
+	}
+	HostPt GetHostReadPt(Bitu phys_page) {
+ 		phys_page-=vgapages.base;
+		return &vga.fastmem[CHECKED3(phys_page*4096)];
+	}
+	void writeb(PhysPt addr,Bitu val) {
+		VGA_ChainedDirectWrite(addr);
+		host_writeb(&vga.fastmem[PAGING_GetPhysicalAddress(addr) & vgapages.mask],(Bit8u)val);
+	}
+	void writew(PhysPt addr,Bitu val) {
+		VGA_ChainedDirectWrite(addr);
+		host_writew(&vga.fastmem[PAGING_GetPhysicalAddress(addr) & vgapages.mask],(Bit16u)val);
+	}
+	void writed(PhysPt addr,Bitu val) {
+		VGA_ChainedDirectWrite(addr);
+		host_writed(&vga.fastmem[PAGING_GetPhysicalAddress(addr) & vgapages.mask],(Bit32u)val);
+	}
+};
+
+class VGA_ChainedDirectWritten_Handler : public VGA_ChainedDirect_Handler {
+public:
+	VGA_ChainedDirectWritten_Handler() {
+		flags=PFLAG_READABLE|PFLAG_WRITEABLE|PFLAG_NOCODE;
+	}
+	HostPt GetHostWritePt(Bitu phys_page) {
+ 		phys_page-=vgapages.base;
+		return &vga.fastmem[CHECKED3(phys_page*4096)];
+	}
+};
+
 class VGA_Changes_Handler : public PageHandler {
 public:
 	VGA_Changes_Handler() {
@@ -546,12 +624,15 @@ public:
 		addr = vga.svga.bank_write_full + (PAGING_GetPhysicalAddress(addr) & 0xffff);
 		addr = CHECKED4(addr);
 		MEM_CHANGED( addr << 3 );
+		VGA_DIRTY( addr << 3 );
 		writeHandler<false>(addr+0,(Bit8u)(val >> 0));
 	}
 	void writew(PhysPt addr,Bitu val) {
 		addr = vga.svga.bank_write_full + (PAGING_GetPhysicalAddress(addr) & 0xffff);
 		addr = CHECKED4(addr);
 		MEM_CHANGED( addr << 3 );
+		VGA_DIRTY( addr << 3 );
+		VGA_DIRTY( (addr+1) << 3 );
 		writeHandler<false>(addr+0,(Bit8u)(val >> 0));
 		writeHandler<false>(addr+1,(Bit8u)(val >> 8));
 	}
@@ -559,6 +640,8 @@ public:
 		addr = vga.svga.bank_write_full + (PAGING_GetPhysicalAddress(addr) & 0xffff);
 		addr = CHECKED4(addr);
 		MEM_CHANGED( addr << 3 );
+		VGA_DIRTY( addr << 3 );
+		VGA_DIRTY( (addr+3) << 3 );
 		writeHandler<false>(addr+0,(Bit8u)(val >> 0));
 		writeHandler<false>(addr+1,(Bit8u)(val >> 8));
 		writeHandler<false>(addr+2,(Bit8u)(val >> 16));
@@ -734,6 +817,8 @@ static struct vg {
 	VGA_TANDY_PageHandler		tandy;
 	VGA_ChainedEGA_Handler		cega;
 	VGA_ChainedVGA_Handler		cvga;
+	VGA_ChainedDirect_Handler	cdirect;
+	VGA_ChainedDirectWritten_Handler	cdirectw;
 	VGA_UnchainedEGA_Handler	uega;
 	VGA_UnchainedVGA_Handler	uvga;
 	VGA_PCJR_Handler			pcjr;
@@ -744,6 +829,56 @@ static struct vg {
 	VGA_Empty_Handler			empty;
 } vgaph;
 
+static Bitu chained_direct_size;
+static Bit32u chained_direct_written;	// pages written since the direct mapping started
+static Bit32u chained_direct_frame;		// pages mapped writable in the current frame
+
+static void VGA_ChainedDirectWrite(PhysPt addr) {
+	Bitu page = (PAGING_GetPhysicalAddress(addr) & vgapages.mask) >> 12;
+	// same stamps as the chained handler, linear and planar address
+	memset(&vga.dirty.map[(page << 12) >> VGA_DIRTY_SHIFT], vga.dirty.frame, 4096 >> VGA_DIRTY_SHIFT);
+	memset(&vga.dirty.map[(page << 14) >> VGA_DIRTY_SHIFT], vga.dirty.frame, 16384 >> VGA_DIRTY_SHIFT);
+	chained_direct_written |= 1 << page;
+	chained_direct_frame |= 1 << page;
+	MEM_SetPageHandler(vgapages.base + page, 1, &vgaph.cdirectw);
+	PAGING_UnlinkPages(addr >> 12, 1);
+}
+
+/* A new frame starts, pages written in the last one go back to read only */
+void VGA_ChainedDirectFrame(void) {
+	if (!chained_direct_frame) return;
+	for (Bitu page=0;page<16;page++) {
+		if (!(chained_direct_frame & (1 << page))) continue;
+		MEM_SetPageHandler(vgapages.base + page, 1, &vgaph.cdirect);
+		if (!paging.enabled) PAGING_UnlinkPages(vgapages.base + page, 1);
+	}
+	// other linear addresses of the pages can't be found
+	if (paging.enabled) PAGING_ClearTLB();
+	chained_direct_frame = 0;
+}
+
+/* Entering or leaving the direct mapping copies between the planes and fastmem,
+   leaving only copies the pages that were written, the planes may have changed
+   through the lfb */
+static void VGA_ChainedDirect(Bitu size) {
+	chained_direct_frame = 0;
+	if (size == chained_direct_size) return;
+	Bitu addr;
+	if (chained_direct_size) {
+		for (addr=0;addr<chained_direct_size;addr+=4) {
+			if (!(chained_direct_written & (1 << (addr >> 12)))) continue;
+			((Bit32u*)vga.mem.linear)[addr] = *(Bit32u*)&vga.fastmem[addr];
+		}
+	}
+	if (size) {
+		for (addr=0;addr<size;addr+=4)
+			*(Bit32u*)&vga.fastmem[addr] = ((Bit32u*)vga.mem.linear)[addr];
+	}
+	LOG(LOG_VGAMISC,LOG_NORMAL)("Chain-4 direct mapping %d bytes",size);
+	chained_direct_size = size;
+	chained_direct_written = 0;
+}
+
 void VGA_ChangedBank(void) {
 #ifndef VGA_LFB_MAPPED
 	//If the mode is accurate than the correct mapper must have been installed already
@@ -757,6 +892,8 @@ void VGA_ChangedBank(void) {
 void VGA_SetupHandlers(void) {
 	vga.svga.bank_read_full = vga.svga.bank_read*vga.svga.bank_size;
 	vga.svga.bank_write_full = vga.svga.bank_write*vga.svga.bank_size;
+	vga.dirty.tracked = false;
+	vga.dirty.invalid = true;
 
 	PageHandler *newHandler;
 	switch (machine) {
@@ -804,6 +941,12 @@ void VGA_SetupHandlers(void) {
 	switch (vga.mode) {
 	case M_ERROR:
 	default:
+		// Leave the direct mapping so the planes are current for whatever mode comes next
+		if (chained_direct_size) {
+			VGA_ChainedDirect(0);
+			MEM_SetPageHandler(vgapages.base, (vgapages.mask+1) >> 12, &vgaph.cvga);
+			PAGING_ClearTLB();
+		}
 		return;
 	case M_LIN4:
 		newHandler = &vgaph.lin4;
@@ -820,9 +963,16 @@ void VGA_SetupHandlers(void) {
 	case M_LIN8:
 	case M_VGA:
 		if (vga.config.chained) {
-			if(vga.config.compatible_chain4)
-				newHandler = &vgaph.cvga;
-			else 
+			if(vga.config.compatible_chain4) {
+				// Direct only when the display reads fastmem as well and the
+				// window stays inside the 64kb it wraps at
+				if ((vga.mode==M_VGA) && (vga.crtc.underline_location & 0x40) &&
+					(vga.gfx.miscellaneous & 0x0c) &&
+					!vga.svga.bank_read_full && !vga.svga.bank_write_full)
+					newHandler = &vgaph.cdirect;
+				else
+					newHandler = &vgaph.cvga;
+			} else 
 #ifdef VGA_LFB_MAPPED
 				newHandler = &vgaph.map;
 #else
@@ -884,8 +1034,14 @@ void VGA_SetupHandlers(void) {
 		MEM_ResetPageHandler( VGA_PAGE_B0, 8 );
 		break;
 	}
+	VGA_ChainedDirect((newHandler == &vgaph.cdirect) ? vgapages.mask+1 : 0);
 	if(svgaCard == SVGA_S3Trio && (vga.s3.ext_mem_ctrl & 0x10))
 		MEM_SetPageHandler(VGA_PAGE_A0, 16, &vgaph.mmio);
+	else if (vga.mode!=M_LIN8) {
+		/* Only these stamp every write into the dirty map */
+		vga.dirty.tracked = (newHandler == &vgaph.cvga) || (newHandler == &vgaph.cdirect) || (newHandler == &vgaph.uvga) ||
+			(newHandler == &vgaph.cega) || (newHandler == &vgaph.uega) || (newHandler == &vgaph.lin4);
+	}
 range_done:
 	PAGING_ClearTLB();
 }
@@ -907,6 +1063,7 @@ static void VGA_Memory_ShutDown(Section * /*sec*/) {
 #ifdef VGA_KEEP_CHANGES
 	delete[] vga.changes.map;
 #endif
+	delete[] vga.dirty.map;
 }
 
 void VGA_SetupMemory(Section* sec) {
@@ -935,6 +1092,13 @@ void VGA_SetupMemory(Section* sec) {
 	vga.changes.map = new Bit8u[changesMapSize];
 	memset(vga.changes.map, 0, changesMapSize);
 #endif
+	int dirtyMapSize = ((vga.vmemsize << 1) >> VGA_DIRTY_SHIFT) + 2;
+	vga.dirty.map = new Bit8u[dirtyMapSize];
+	memset(vga.dirty.map, 0, dirtyMapSize);
+	vga.dirty.frame = 0;
+	vga.dirty.tracked = false;
+	vga.dirty.skip = false;
+	vga.dirty.invalid = true;
 	vga.svga.bank_read = vga.svga.bank_write = 0;
 	vga.svga.bank_read_full = vga.svga.bank_write_full = 0;
 	vga.svga.bank_size = 0x10000; /* most common bank size is 64K */
@@ -83,6 +83,7 @@ void write_p3c5(Bitu /*port*/,Bitu val,Bitu iolen) {
 			Bit8u font2=((val & 0xc) >> 1);
 			if (IS_VGA_ARCH) font2|=(val & 0x20) >> 5;
 			vga.draw.font_tables[1]=&vga.draw.font[font2*8*1024];
+			vga.draw.glyph_gen++;
 		}
 		/*
 			0,1,4  Selects VGA Character Map (0..7) if bit 3 of the character
@@ -453,7 +453,152 @@ void XGA_DrawLineBresenham(Bitu val) {
 	
 }
 
+/* Row kernels for the common rectangle ops, these write video memory
+   directly instead of going through XGA_GetPoint/XGA_DrawPoint per pixel */
+
+static Bitu XGA_PixelSize(void) {
+	switch(XGA_COLOR_MODE) {
+	case M_LIN8: return 1;
+	case M_LIN15:
+	case M_LIN16: return 2;
+	case M_LIN32: return 4;
+	default: return 0;
+	}
+}
+
+static Bitu XGA_PixelMask(void) {
+	switch(XGA_COLOR_MODE) {
+	case M_LIN15: return 0x7fff;
+	case M_LIN16: return 0xffff;
+	default: return 0xffffffff;
+	}
+}
+
+template <class T>
+static void XGA_MixRow(T * dst, Bitu count, Bitu mixmode, Bitu srcval, Bitu mask) {
+	switch (mixmode & 0xf) {
+	case 0x01: /* 0 */
+	case 0x02: /* 1 */
+	case 0x07: /* SRC */
+		{
+			T fill = (T)(XGA_GetMixResult(mixmode, srcval, 0) & mask);
+			if (sizeof(T) == 1) memset(dst, fill, count);
+			else while (count--) *dst++ = fill;
+		}
+		break;
+	default:
+		while (count--) {
+			*dst = (T)(XGA_GetMixResult(mixmode, srcval, *dst) & mask);
+			dst++;
+		}
+		break;
+	}
+}
+
+template <class T>
+static void XGA_BlitRow(T * dst, const T * src, Bits count, Bits dx, Bitu mixmode, Bitu mask) {
+	if ((mixmode & 0xf) == 0x07 && (T)mask == (T)~0) {
+		// a forward copy to the right or a backward copy to the left would
+		// smear the source, these are handled pixel by pixel below
+		if ((dx > 0) ? (dst <= src || dst >= src + count) : (dst >= src || dst + count <= src)) {
+			memmove((dx > 0) ? dst : dst - (count - 1), (dx > 0) ? src : src - (count - 1), count * sizeof(T));
+			return;
+		}
+	}
+	while (count--) {
+		*dst = (T)(XGA_GetMixResult(mixmode, *src, *dst) & mask);
+		dst += dx;
+		src += dx;
+	}
+}
+
+/* Clip a run of pixels starting at x going in direction dx to the scissors
+   and video memory, returns the number of pixels left and updates x */
+static Bits XGA_ClipRow(Bits & x, Bits y, Bits count, Bits dx) {
+	if (y < xga.scissors.y1 || y > xga.scissors.y2) return 0;
+	Bits left = (dx > 0) ? x : x - count + 1;
+	Bits right = left + count - 1;
+	if (left < xga.scissors.x1) left = xga.scissors.x1;
+	if (right > xga.scissors.x2) right = xga.scissors.x2;
+	Bits limit = (Bits)(vga.vmemsize / XGA_PixelSize()) - y * (Bits)XGA_SCREEN_WIDTH - 1;
+	if (right > limit) right = limit;
+	if (left > right) return 0;
+	x = (dx > 0) ? left : right;
+	return right - left + 1;
+}
+
+static bool XGA_FillRectFast(Bitu val) {
+	if ((xga.pix_cntl >> 6) & 0x3) return false;
+	Bitu mixmode = xga.foremix;
+	Bitu srcval;
+	switch ((mixmode >> 5) & 0x03) {
+	case 0x00: srcval = xga.backcolor; break;
+	case 0x01: srcval = xga.forecolor; break;
+	default: return false;
+	}
+	Bitu size = XGA_PixelSize();
+	if (!size) return false;
+	Bitu mask = XGA_PixelMask();
+	Bits dx = (val & 0x20) ? 1 : -1;
+	Bits dy = (val & 0x80) ? 1 : -1;
+	Bits w = xga.MAPcount + 1;
+	Bits y = xga.cury;
+	if ((xga.curcommand & 0x11) == 0x11) {
+		for (Bitu yat=0;yat<=xga.MIPcount;yat++, y+=dy) {
+			Bits x = xga.curx;
+			Bits count = XGA_ClipRow(x, y, w, dx);
+			if (!count) continue;
+			if (dx < 0) x -= count - 1;
+			Bit8u * row = &vga.mem.linear[(y * XGA_SCREEN_WIDTH + x) * size];
+			switch (size) {
+			case 1: XGA_MixRow<Bit8u>(row, count, mixmode, srcval, mask); break;
+			case 2: XGA_MixRow<Bit16u>((Bit16u *)row, count, mixmode, srcval, mask); break;
+			case 4: XGA_MixRow<Bit32u>((Bit32u *)row, count, mixmode, srcval, mask); break;
+			}
+		}
+	}
+	xga.curx = (Bit16u)(xga.curx + dx * w);
+	xga.cury = (Bit16u)(xga.cury + dy * (Bits)(xga.MIPcount + 1));
+	return true;
+}
+
+static bool XGA_BlitRectFast(Bitu val) {
+	if ((xga.pix_cntl >> 6) & 0x3) return false;
+	Bitu mixmode = xga.foremix;
+	if (((mixmode >> 5) & 0x03) != 0x03) return false;
+	Bitu size = XGA_PixelSize();
+	if (!size) return false;
+	Bits dx = (val & 0x20) ? 1 : -1;
+	Bits dy = (val & 0x80) ? 1 : -1;
+	Bits w = xga.MAPcount + 1;
+	Bits h = xga.MIPcount + 1;
+	// the source isn't clipped, leave anything reading outside memory to XGA_GetPoint
+	Bits sx1 = (dx > 0) ? xga.curx : xga.curx - w + 1;
+	Bits sy1 = (dy > 0) ? xga.cury : xga.cury - h + 1;
+	if (sx1 < 0 || sy1 < 0) return false;
+	if (((sy1 + h - 1) * (Bits)XGA_SCREEN_WIDTH + sx1 + w) * (Bits)size > (Bits)vga.vmemsize) return false;
+	if ((xga.curcommand & 0x11) != 0x11) return true;
+	Bitu mask = XGA_PixelMask();
+	Bits sy = xga.cury;
+	Bits ty = xga.desty;
+	for (Bits yat=0;yat<h;yat++, sy+=dy, ty+=dy) {
+		Bits tx = xga.destx;
+		Bits count = XGA_ClipRow(tx, ty, w, dx);
+		if (!count) continue;
+		Bits sx = xga.curx + (tx - xga.destx);
+		Bit8u * dst = &vga.mem.linear[(ty * XGA_SCREEN_WIDTH + tx) * size];
+		Bit8u * src = &vga.mem.linear[(sy * XGA_SCREEN_WIDTH + sx) * size];
+		switch (size) {
+		case 1: XGA_BlitRow<Bit8u>(dst, src, count, dx, mixmode, mask); break;
+		case 2: XGA_BlitRow<Bit16u>((Bit16u *)dst, (Bit16u *)src, count, dx, mixmode, mask); break;
+		case 4: XGA_BlitRow<Bit32u>((Bit32u *)dst, (Bit32u *)src, count, dx, mixmode, mask); break;
+		}
+	}
+	return true;
+}
+
 void XGA_DrawRectangle(Bitu val) {
+	if (XGA_FillRectFast(val)) return;
 	Bit32u xat, yat;
 	Bitu srcval;
 	Bitu destval;
@@ -718,6 +863,7 @@ void XGA_DrawWait(Bitu val, Bitu len) {
 }
 
 void XGA_BlitRect(Bitu val) {
+	if (XGA_BlitRectFast(val)) return;
 	Bit32u xat, yat;
 	Bitu srcdata;
 	Bitu dstdata;
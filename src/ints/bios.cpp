@@ -828,6 +828,7 @@ void BIOS_ZeroExtendedSize(bool in) {
 
 void BIOS_SetupKeyboard(void);
 void BIOS_SetupDisks(void);
+void BIOS_FlushDisks(void);
 
 class BIOS:public Module_base{
 private:
@@ -1080,6 +1081,8 @@ public:
 		size_extended|=(IO_Read(0x71) << 8);
 	}
 	~BIOS(){
+		/* write back cached disk image data */
+		BIOS_FlushDisks();
 		/* abort DAC playing */
 		if (tandy_sb.port) {
 			IO_Write(tandy_sb.port+0xc,0xd3);
@@ -26,9 +26,21 @@
 #include "dos_inc.h" /* for Drives[] */
 #include "../dos/drives.h"
 #include "mapper.h"
+#include "compressed_image.h"
+#include "timer.h"
+
+#if defined (C_HAVE_MMAP)
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
 
 #define MAX_DISK_IMAGES 4
 
+/* Delta file layout for imageDisk overlays */
+#define IMGDISK_OVERLAY_HEADER 16
+#define IMGDISK_OVERLAY_RECORD (4 + IMGDISK_BLOCK_SIZE)
+static const char overlayMagic[8] = { 'D','B','X','D','E','L','T','A' };
+
 diskGeo DiskGeometryList[] = {
 	{ 160,  8, 1, 40, 0},
 	{ 180,  9, 1, 40, 0},
@@ -146,13 +158,7 @@ Bit8u imageDisk::Read_Sector(Bit32u head,Bit32u cylinder,Bit32u sector,void * da
 }
 
 Bit8u imageDisk::Read_AbsoluteSector(Bit32u sectnum, void * data) {
-	Bit32u bytenum;
-
-	bytenum = sectnum * sector_size;
-
-	fseek(diskimg,bytenum,SEEK_SET);
-	fread(data, 1, sector_size, diskimg);
-
+	ReadBytes(sectnum * sector_size, sector_size, data);
 	return 0x00;
 }
 
@@ -167,25 +173,261 @@ Bit8u imageDisk::Write_Sector(Bit32u head,Bit32u cylinder,Bit32u sector,void * d
 
 
 Bit8u imageDisk::Write_AbsoluteSector(Bit32u sectnum, void *data) {
-	Bit32u bytenum;
+	//LOG_MSG("Writing sectors to %ld at bytenum %d", sectnum, sectnum * sector_size);
+	return WriteBytes(sectnum * sector_size, sector_size, data);
+}
+
+/* Contiguous sectors in one transfer */
+Bit8u imageDisk::Read_AbsoluteSectors(Bit32u sectnum, Bit32u count, void * data) {
+	return ReadBytes(sectnum * sector_size, count * sector_size, data);
+}
+
+Bit8u imageDisk::Write_AbsoluteSectors(Bit32u sectnum, Bit32u count, void * data) {
+	return WriteBytes(sectnum * sector_size, count * sector_size, data);
+}
+
+Bit8u imageDisk::ReadBytes(Bit32u pos, Bit32u len, void * data) {
+	Bit8u * dest = (Bit8u *)data;
+	Bit8u ret = 0x00;
+	if (pos >= imgSize) {
+		memset(dest, 0, len);
+		return 0x05;
+	}
+	if (len > imgSize - pos) {
+		memset(dest + (imgSize - pos), 0, len - (imgSize - pos));
+		len = imgSize - pos;
+		ret = 0x05;
+	}
+	if (mapped && !overlay) {
+		memcpy(dest, mapped + pos, len);
+		return ret;
+	}
+	while (len) {
+		Bit32u offset = pos % IMGDISK_BLOCK_SIZE;
+		Bit32u chunk = IMGDISK_BLOCK_SIZE - offset;
+		if (chunk > len) chunk = len;
+		CacheBlock * cb = GetBlock(pos / IMGDISK_BLOCK_SIZE, true);
+		memcpy(dest, cb->data + offset, chunk);
+		dest += chunk; pos += chunk; len -= chunk;
+	}
+	return ret;
+}
+
+/* Cached writes reach the image file at the latest this many ms after they were made */
+#define IMGDISK_FLUSH_DELAY 2000
+static Bitu flushDelay = 0;
+
+static void IMGDISK_FlushTick(void) {
+	if (flushDelay && !--flushDelay) imageDisk::FlushAll();
+}
+
+Bit8u imageDisk::WriteBytes(Bit32u pos, Bit32u len, void * data) {
+	Bit8u * src = (Bit8u *)data;
+	if (readOnly && !overlay) return 0x05;
+	while (len) {
+		Bit32u offset = pos % IMGDISK_BLOCK_SIZE;
+		Bit32u chunk = IMGDISK_BLOCK_SIZE - offset;
+		if (chunk > len) chunk = len;
+		/* Blocks that get overwritten completely need not be read first */
+		CacheBlock * cb = GetBlock(pos / IMGDISK_BLOCK_SIZE, chunk != IMGDISK_BLOCK_SIZE);
+		memcpy(cb->data + offset, src, chunk);
+		cb->dirty = true;
+		dirty = true;
+		if (!flushDelay) flushDelay = IMGDISK_FLUSH_DELAY;
+		src += chunk; pos += chunk; len -= chunk;
+		if (pos > imgSize) imgSize = pos;
+	}
+	return 0x00;
+}
+
+imageDisk::CacheBlock * imageDisk::GetBlock(Bit32u block, bool load) {
+	CacheBlock * cb = &cache[lastHit];
+	if (cb->block != block) {
+		Bitu i, victim = 0;
+		for (i = 0; i < IMGDISK_CACHE_BLOCKS; i++) {
+			if (cache[i].block == block) break;
+			/* Prefer unused slots, then the least recently used one */
+			if (!cache[i].data) {
+				if (cache[victim].data) victim = i;
+			} else if (cache[victim].data && cache[i].lastUse < cache[victim].lastUse) victim = i;
+		}
+		if (i == IMGDISK_CACHE_BLOCKS) {
+			i = victim;
+			cb = &cache[i];
+			if (cb->dirty) WriteBlock(cb);
+			if (!cb->data) cb->data = new Bit8u[IMGDISK_BLOCK_SIZE];
+			cb->block = block;
+			Bit32u got = load ? LoadBlock(block, cb->data) : 0;
+			if (got < IMGDISK_BLOCK_SIZE) memset(cb->data + got, 0, IMGDISK_BLOCK_SIZE - got);
+		}
+		lastHit = i;
+		cb = &cache[i];
+	}
+	cb->lastUse = ++useCount;
+	return cb;
+}
+
+Bit32u imageDisk::LoadBlock(Bit32u block, Bit8u * data) {
+	if (overlay && block < overlayIndex.size() && overlayIndex[block]) {
+		fseek(overlay, IMGDISK_OVERLAY_HEADER + (overlayIndex[block] - 1) * IMGDISK_OVERLAY_RECORD + 4, SEEK_SET);
+		return (Bit32u)fread(data, 1, IMGDISK_BLOCK_SIZE, overlay);
+	}
+	Bit32u start = block * IMGDISK_BLOCK_SIZE;
+	if (mapped) {
+		if (start >= mappedSize) return 0;
+		Bit32u len = mappedSize - start;
+		if (len > IMGDISK_BLOCK_SIZE) len = IMGDISK_BLOCK_SIZE;
+		memcpy(data, mapped + start, len);
+		return len;
+	}
+	if (packed) return (Bit32u)packed->Read(start, IMGDISK_BLOCK_SIZE, data);
+	fseek(diskimg, start, SEEK_SET);
+	return (Bit32u)fread(data, 1, IMGDISK_BLOCK_SIZE, diskimg);
+}
+
+void imageDisk::WriteBlock(CacheBlock * cb) {
+	if (overlay) {
+		/* Blocks get a record in the delta file the first time they are written */
+		if (cb->block >= overlayIndex.size()) overlayIndex.resize(cb->block + 1, 0);
+		Bit32u record = overlayIndex[cb->block];
+		if (!record) {
+			Bit8u recordHead[4];
+			host_writed(recordHead, cb->block);
+			record = overlayIndex[cb->block] = ++overlayRecords;
+			fseek(overlay, IMGDISK_OVERLAY_HEADER + (record - 1) * IMGDISK_OVERLAY_RECORD, SEEK_SET);
+			fwrite(recordHead, 1, 4, overlay);
+		} else fseek(overlay, IMGDISK_OVERLAY_HEADER + (record - 1) * IMGDISK_OVERLAY_RECORD + 4, SEEK_SET);
+		if (fwrite(cb->data, 1, IMGDISK_BLOCK_SIZE, overlay) != IMGDISK_BLOCK_SIZE) {
+			LOG_MSG("ImageLoader: error writing to overlay of \"%s\"", diskname);
+			writeError = 0x05;
+		}
+		cb->dirty = false;
+		return;
+	}
+	Bit32u start = cb->block * IMGDISK_BLOCK_SIZE;
+	Bit32u len = imgSize - start;
+	if (len > IMGDISK_BLOCK_SIZE) len = IMGDISK_BLOCK_SIZE;
+	fseek(diskimg, start, SEEK_SET);
+	if (fwrite(cb->data, 1, len, diskimg) != len) {
+		LOG_MSG("ImageLoader: error writing back to image \"%s\"", diskname);
+		writeError = 0x05;
+	}
+	cb->dirty = false;
+}
 
-	bytenum = sectnum * sector_size;
+Bit8u imageDisk::Flush(void) {
+	if (!dirty) return writeError;
+	for (Bitu i = 0; i < IMGDISK_CACHE_BLOCKS; i++) {
+		if (cache[i].dirty) WriteBlock(&cache[i]);
+	}
+	dirty = false;
+	if (overlay) {
+		WriteOverlayHeader();
+		if (fflush(overlay)) writeError = 0x05;
+	} else if (fflush(diskimg)) writeError = 0x05;
+	return writeError;
+}
 
-	//LOG_MSG("Writing sectors to %ld at bytenum %d", sectnum, bytenum);
+Bit8u imageDisk::TakeWriteError(void) {
+	Bit8u ret = writeError;
+	writeError = 0x00;
+	return ret;
+}
 
-	fseek(diskimg,bytenum,SEEK_SET);
-	size_t ret=fwrite(data, sector_size, 1, diskimg);
+void imageDisk::WriteOverlayHeader(void) {
+	Bit8u header[IMGDISK_OVERLAY_HEADER];
+	memcpy(header, overlayMagic, 8);
+	host_writed(&header[8], IMGDISK_BLOCK_SIZE);
+	host_writed(&header[12], imgSize);
+	fseek(overlay, 0, SEEK_SET);
+	fwrite(header, 1, IMGDISK_OVERLAY_HEADER, overlay);
+}
 
-	return ((ret>0)?0x00:0x05);
+bool imageDisk::SetOverlay(const char * overlayName) {
+	Bit8u header[IMGDISK_OVERLAY_HEADER];
+	FILE * ovl = fopen(overlayName, "rb+");
+	overlayIndex.clear();
+	overlayRecords = 0;
+	if (ovl) {
+		if ((fread(header, 1, IMGDISK_OVERLAY_HEADER, ovl) != IMGDISK_OVERLAY_HEADER) ||
+			memcmp(header, overlayMagic, 8) || (host_readd(&header[8]) != IMGDISK_BLOCK_SIZE)) {
+			LOG_MSG("ImageLoader: \"%s\" is not an overlay file", overlayName);
+			fclose(ovl);
+			return false;
+		}
+		if (host_readd(&header[12]) > imgSize) imgSize = host_readd(&header[12]);
+		/* Rebuild the block index from the records */
+		Bit8u recordHead[4];
+		while (!fseek(ovl, IMGDISK_OVERLAY_HEADER + overlayRecords * IMGDISK_OVERLAY_RECORD, SEEK_SET) &&
+			(fread(recordHead, 1, 4, ovl) == 4)) {
+			Bit32u block = host_readd(recordHead);
+			if (block >= overlayIndex.size()) overlayIndex.resize(block + 1, 0);
+			overlayIndex[block] = ++overlayRecords;
+		}
+		LOG_MSG("ImageLoader: using %d changed blocks from overlay \"%s\"", overlayRecords, overlayName);
+	} else {
+		ovl = fopen(overlayName, "wb+");
+		if (!ovl) return false;
+	}
+	overlay = ovl;
+	WriteOverlayHeader();
+	/* Anything cached so far was read from the image without the delta */
+	for (Bitu i = 0; i < IMGDISK_CACHE_BLOCKS; i++) {
+		cache[i].block = 0xffffffff;
+		cache[i].dirty = false;
+	}
+	dirty = false;
+	return true;
+}
 
+imageDisk * imageDisk::first = 0;
+
+void imageDisk::FlushAll(void) {
+	for (imageDisk * disk = first; disk; disk = disk->next) disk->Flush();
 }
 
-imageDisk::imageDisk(FILE *imgFile, Bit8u *imgName, Bit32u imgSizeK, bool isHardDisk) {
+imageDisk::imageDisk(FILE *imgFile, Bit8u *imgName, Bit32u imgSizeK, bool isHardDisk, bool isReadOnly) {
 	heads = 0;
 	cylinders = 0;
 	sectors = 0;
 	sector_size = 512;
 	diskimg = imgFile;
+
+	for (Bitu i = 0; i < IMGDISK_CACHE_BLOCKS; i++) {
+		cache[i].block = 0xffffffff;
+		cache[i].lastUse = 0;
+		cache[i].dirty = false;
+		cache[i].data = 0;
+	}
+	dirty = false;
+	writeError = 0x00;
+	lastHit = 0;
+	useCount = 0;
+	readOnly = isReadOnly;
+	mapped = 0;
+	mappedSize = 0;
+	overlay = 0;
+	overlayRecords = 0;
+	packed = compressedImage::Open(diskimg);
+	if (packed) {
+		imgSize = (Bit32u)packed->GetSize();
+		readOnly = true;
+	} else {
+		fseek(diskimg, 0L, SEEK_END);
+		imgSize = (Bit32u)ftell(diskimg);
+	}
+#if defined (C_HAVE_MMAP)
+	if (!packed && (fcntl(fileno(diskimg), F_GETFL) & O_ACCMODE) == O_RDONLY) readOnly = true;
+	if (!packed && readOnly && imgSize) {
+		void * map = mmap(0, imgSize, PROT_READ, MAP_SHARED, fileno(diskimg), 0);
+		if (map != MAP_FAILED) {
+			mapped = (Bit8u *)map;
+			mappedSize = imgSize;
+		}
+	}
+#endif
+	next = first;
+	first = this;
 	
 	memset(diskname,0,512);
 	if(strlen((const char *)imgName) > 511) {
@@ -231,6 +473,20 @@ imageDisk::imageDisk(FILE *imgFile, Bit8u *imgName, Bit32u imgSizeK, bool isHard
 	}
 }
 
+imageDisk::~imageDisk() {
+	Flush();
+	for (Bitu i = 0; i < IMGDISK_CACHE_BLOCKS; i++) delete[] cache[i].data;
+#if defined (C_HAVE_MMAP)
+	if (mapped) munmap(mapped, mappedSize);
+#endif
+	delete packed;
+	if (overlay) fclose(overlay);
+	if (diskimg != NULL) fclose(diskimg);
+	imageDisk ** link = &first;
+	while (*link != this) link = &(*link)->next;
+	*link = next;
+}
+
 void imageDisk::Set_Geometry(Bit32u setHeads, Bit32u setCyl, Bit32u setSect, Bit32u setSectSize) {
 	heads = setHeads;
 	cylinders = setCyl;
@@ -333,8 +589,14 @@ static Bitu INT13_DiskHandler(void) {
 				}
 				return CBRET_NONE;
 			}
-			last_status = 0x00;
-			CALLBACK_SCF(false);
+			/* Good moment to get cached writes onto the image */
+			imageDisk::FlushAll();
+			/* Report write backs that failed since the last write or reset */
+			last_status = any_images ? imageDiskList[drivenum]->TakeWriteError() : 0x00;
+			if (last_status) {
+				reg_ah = last_status;
+				CALLBACK_SCF(true);
+			} else CALLBACK_SCF(false);
 		}
         break;
 	case 0x1: /* Get status of last operation */
@@ -394,6 +656,13 @@ static Bitu INT13_DiskHandler(void) {
 			return CBRET_NONE;
         }                     
 
+		/* An earlier write that failed going to the image fails this one */
+		last_status = imageDiskList[drivenum]->TakeWriteError();
+		if (last_status) {
+			reg_ah = last_status;
+			CALLBACK_SCF(true);
+			return CBRET_NONE;
+		}
 
 		bufptr = reg_bx;
 		for(i=0;i<reg_al;i++) {
@@ -491,9 +760,14 @@ static Bitu INT13_DiskHandler(void) {
 }
 
 
+void BIOS_FlushDisks(void) {
+	imageDisk::FlushAll();
+}
+
 void BIOS_SetupDisks(void) {
 /* TODO Start the time correctly */
 	call_int13=CALLBACK_Allocate();	
+	TIMER_AddTickHandler(&IMGDISK_FlushTick);
 	CALLBACK_Setup(call_int13,&INT13_DiskHandler,CB_IRET,"Int 13 Bios disk");
 	RealSetVec(0x13,CALLBACK_RealPointer(call_int13));
 	int i;
@@ -0,0 +1,253 @@
+/*
+ *  Copyright (C) 2002-2010  The DOSBox Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include "dosbox.h"
+#include "mem.h"
+#include "compressed_image.h"
+
+#if defined (C_ZLIB)
+#include <zlib.h>
+#endif
+
+static const char cimageMagic[8] = { 'D','B','X','C','I','M','G','1' };
+
+static INLINE Bit64u read_qword(Bit8u * src) {
+	return (Bit64u)host_readd(src) | ((Bit64u)host_readd(src + 4) << 32);
+}
+
+static INLINE void write_qword(Bit8u * dst, Bit64u val) {
+	host_writed(dst, (Bit32u)val);
+	host_writed(dst + 4, (Bit32u)(val >> 32));
+}
+
+compressedImage::compressedImage(FILE * imgFile) {
+	file = imgFile;
+	size = 0;
+	blockSize = 0;
+	blockCount = 0;
+	index = 0;
+	packed = 0;
+	useCount = 0;
+	for (Bitu i = 0; i < CIMAGE_CACHE_BLOCKS; i++) {
+		cache[i].block = 0xffffffff;
+		cache[i].lastUse = 0;
+		cache[i].data = 0;
+	}
+}
+
+compressedImage::~compressedImage() {
+	for (Bitu i = 0; i < CIMAGE_CACHE_BLOCKS; i++) delete[] cache[i].data;
+	delete[] index;
+	delete[] packed;
+}
+
+bool compressedImage::ReadHeader(void) {
+	Bit8u header[CIMAGE_HEADER_SIZE];
+	fseek(file, 0L, SEEK_END);
+	Bit64u fileSize = (Bit64u)ftell(file);
+	fseek(file, 0L, SEEK_SET);
+	if (fread(header, 1, CIMAGE_HEADER_SIZE, file) != CIMAGE_HEADER_SIZE) return false;
+	if (memcmp(header, cimageMagic, 8)) return false;
+	blockSize = host_readd(&header[8]);
+	blockCount = host_readd(&header[12]);
+	size = read_qword(&header[16]);
+	/* Everything below is sized from the header, check it against the file before allocating */
+	if (blockSize < 512 || blockSize > CIMAGE_MAX_BLOCK_SIZE) return false;
+	if ((Bit64u)blockCount * blockSize < size) return false;
+	if (((Bit64u)blockCount + 1) * 8 > fileSize - CIMAGE_HEADER_SIZE) return false;
+
+	Bitu indexLen = (blockCount + 1) * 8;
+	Bit8u * raw = new Bit8u[indexLen];
+	if (fread(raw, 1, indexLen, file) != indexLen) {
+		delete[] raw;
+		return false;
+	}
+	index = new Bit64u[blockCount + 1];
+	for (Bitu i = 0; i <= blockCount; i++) index[i] = read_qword(&raw[i * 8]);
+	delete[] raw;
+	/* Blocks are stored in order and inside the file */
+	if (index[0] < CIMAGE_HEADER_SIZE + indexLen || index[blockCount] > fileSize) return false;
+	for (Bitu i = 0; i < blockCount; i++) if (index[i + 1] < index[i]) return false;
+	packed = new Bit8u[blockSize];
+	return true;
+}
+
+compressedImage * compressedImage::Open(FILE * imgFile) {
+	char magic[8];
+	fseek(imgFile, 0L, SEEK_SET);
+	if ((fread(magic, 1, 8, imgFile) != 8) || memcmp(magic, cimageMagic, 8)) return 0;
+#if defined (C_ZLIB)
+	compressedImage * img = new compressedImage(imgFile);
+	if (img->ReadHeader()) return img;
+	LOG_MSG("ImageLoader: damaged compressed image header");
+	delete img;
+#else
+	LOG_MSG("ImageLoader: compressed images need zlib support");
+#endif
+	return 0;
+}
+
+Bit64u compressedImage::ImageSize(FILE * imgFile) {
+	compressedImage * img = Open(imgFile);
+	if (img) {
+		Bit64u len = img->GetSize();
+		delete img;
+		return len;
+	}
+	fseek(imgFile, 0L, SEEK_END);
+	return (Bit64u)ftell(imgFile);
+}
+
+compressedImage::CacheBlock * compressedImage::GetBlock(Bit32u block) {
+	Bitu i, victim = 0;
+	for (i = 0; i < CIMAGE_CACHE_BLOCKS; i++) {
+		if (cache[i].block == block) {
+			cache[i].lastUse = ++useCount;
+			return &cache[i];
+		}
+		if (cache[i].lastUse < cache[victim].lastUse) victim = i;
+	}
+	CacheBlock * cb = &cache[victim];
+	if (!cb->data) cb->data = new Bit8u[blockSize];
+	cb->block = 0xffffffff;
+
+	Bit32u want = blockSize;
+	if ((Bit64u)(block + 1) * blockSize > size) want = (Bit32u)(size - (Bit64u)block * blockSize);
+	Bit64u stored = index[block + 1] - index[block];
+	if (stored > blockSize) return 0;
+	fseek(file, (long)index[block], SEEK_SET);
+	if (fread(stored == want ? cb->data : packed, 1, (size_t)stored, file) != stored) return 0;
+#if defined (C_ZLIB)
+	if (stored != want) {
+		uLongf outLen = blockSize;
+		if ((uncompress(cb->data, &outLen, packed, (uLong)stored) != Z_OK) || (outLen != want)) return 0;
+	}
+#endif
+	cb->block = block;
+	cb->lastUse = ++useCount;
+	return cb;
+}
+
+Bitu compressedImage::Read(Bit64u pos, Bitu len, void * data) {
+	Bit8u * dest = (Bit8u *)data;
+	Bitu done = 0;
+	if (pos >= size) return 0;
+	if (len > size - pos) len = (Bitu)(size - pos);
+	while (done < len) {
+		Bit32u offset = (Bit32u)(pos % blockSize);
+		Bitu chunk = blockSize - offset;
+		if (chunk > len - done) chunk = len - done;
+		CacheBlock * cb = GetBlock((Bit32u)(pos / blockSize));
+		if (!cb) {
+			LOG_MSG("ImageLoader: error reading compressed block %d", (Bit32u)(pos / blockSize));
+			break;
+		}
+		memcpy(dest + done, cb->data + offset, chunk);
+		done += chunk;
+		pos += chunk;
+	}
+	return done;
+}
+
+bool compressedImage::Convert(const char * srcName, const char * dstName) {
+#if defined (C_ZLIB)
+	FILE * src = fopen(srcName, "rb");
+	if (!src) {
+		LOG_MSG("Can't open image %s", srcName);
+		return false;
+	}
+	compressedImage * check = Open(src);
+	if (check) {
+		delete check;
+		fclose(src);
+		LOG_MSG("%s is already compressed", srcName);
+		return false;
+	}
+	fseek(src, 0L, SEEK_END);
+	Bit64u srcSize = (Bit64u)ftell(src);
+	fseek(src, 0L, SEEK_SET);
+	FILE * dst = fopen(dstName, "wb");
+	if (!dst) {
+		fclose(src);
+		LOG_MSG("Can't create %s", dstName);
+		return false;
+	}
+
+	Bit32u count = (Bit32u)((srcSize + CIMAGE_BLOCK_SIZE - 1) / CIMAGE_BLOCK_SIZE);
+	Bitu indexLen = (count + 1) * 8;
+	Bit8u header[CIMAGE_HEADER_SIZE];
+	Bit8u * rawIndex = new Bit8u[indexLen];
+	Bit8u * in = new Bit8u[CIMAGE_BLOCK_SIZE];
+	uLongf outMax = compressBound(CIMAGE_BLOCK_SIZE);
+	Bit8u * out = new Bit8u[outMax];
+	bool ok = true;
+
+	memset(header, 0, CIMAGE_HEADER_SIZE);
+	memcpy(header, cimageMagic, 8);
+	host_writed(&header[8], CIMAGE_BLOCK_SIZE);
+	host_writed(&header[12], count);
+	write_qword(&header[16], srcSize);
+	/* Index gets filled in once the block sizes are known */
+	memset(rawIndex, 0, indexLen);
+	ok = (fwrite(header, 1, CIMAGE_HEADER_SIZE, dst) == CIMAGE_HEADER_SIZE) &&
+		(fwrite(rawIndex, 1, indexLen, dst) == indexLen);
+
+	Bit64u offset = CIMAGE_HEADER_SIZE + indexLen;
+	for (Bit32u block = 0; ok && block < count; block++) {
+		Bitu want = CIMAGE_BLOCK_SIZE;
+		if ((Bit64u)(block + 1) * CIMAGE_BLOCK_SIZE > srcSize) want = (Bitu)(srcSize - (Bit64u)block * CIMAGE_BLOCK_SIZE);
+		if (fread(in, 1, want, src) != want) {
+			LOG_MSG("Error reading %s", srcName);
+			ok = false;
+			break;
+		}
+		uLongf outLen = outMax;
+		const Bit8u * store = out;
+		/* Keep blocks that don't shrink as they are */
+		if ((compress2(out, &outLen, in, (uLong)want, Z_BEST_COMPRESSION) != Z_OK) || (outLen >= want)) {
+			store = in;
+			outLen = (uLongf)want;
+		}
+		write_qword(&rawIndex[block * 8], offset);
+		if (fwrite(store, 1, outLen, dst) != outLen) ok = false;
+		offset += outLen;
+	}
+	write_qword(&rawIndex[count * 8], offset);
+	if (ok) {
+		fseek(dst, CIMAGE_HEADER_SIZE, SEEK_SET);
+		ok = (fwrite(rawIndex, 1, indexLen, dst) == indexLen);
+	}
+	if (fclose(dst)) ok = false;
+	fclose(src);
+	delete[] rawIndex;
+	delete[] in;
+	delete[] out;
+	if (!ok) {
+		LOG_MSG("Error writing %s", dstName);
+		remove(dstName);
+		return false;
+	}
+	LOG_MSG("Compressed %s to %s: %dKB of %dKB", srcName, dstName,
+		(Bit32u)(offset / 1024), (Bit32u)(srcSize / 1024));
+	return true;
+#else
+	LOG_MSG("Image compression needs zlib support");
+	return false;
+#endif
+}
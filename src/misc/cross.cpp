@@ -31,6 +31,11 @@
 #include <shlobj.h>
 #endif
 
+#ifndef WIN32
+#include <sys/time.h>
+#include <time.h>
+#endif
+
 #if defined HAVE_SYS_TYPES_H && defined HAVE_PWD_H
 #include <sys/types.h>
 #include <pwd.h>
@@ -151,6 +156,27 @@ void Cross::CreateDir(std::string const& in) {
 #endif
 }
 
+Bit64u Cross::GetMicroTicks(void) {
+#ifdef WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+	if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (Bit64u)(now.QuadPart / freq.QuadPart) * 1000000 +
+		(Bit64u)(now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#else
+#if defined(CLOCK_MONOTONIC)
+	/* gettimeofday jumps when the host clock gets adjusted */
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC,&ts) == 0)
+		return (Bit64u)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+	struct timeval now;
+	gettimeofday(&now,0);
+	return (Bit64u)now.tv_sec * 1000000 + now.tv_usec;
+#endif
+}
+
 #if defined (WIN32)
 
 dir_information* open_directory(const char* dirname) {
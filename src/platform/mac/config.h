@@ -52,6 +52,7 @@
 /* #undef C_MODEM */ /* Define to 1 to enable internal modem support, requires SDL_net */
 /* #undef C_SDL_SOUND */ /* Define to 1 to enable SDL_sound support */
 /* #undef C_SSHOT */ /* Define to 1 to enable screenshots, requires libpng */
+# define C_ZLIB 1 /* Define to 1 to enable compressed disk and CD images, requires zlib */
 
 // ----- HEADERS: Define if headers exist in build environment
 #define HAVE_INTTYPES_H 1
@@ -79,6 +80,7 @@
 
 #ifndef __WIN32__
 # define C_HAVE_MPROTECT 1 /* Define to 1 if you have the mprotect function */
+# define C_HAVE_MMAP 1 /* Define to 1 if you have the mmap function */
 #endif
 
 // ----- COMPILER FEATURES
@@ -6,6 +6,9 @@
 /* Define to 1 to enable screenshots, requires libpng */
 #define C_SSHOT 1
 
+/* Define to 1 to enable compressed disk and CD images, requires zlib */
+#define C_ZLIB 1
+
 /* Define to 1 to use opengl display output support */
 #define C_OPENGL 1
 